@@ -7,18 +7,33 @@
 
 #include <boost/program_options.hpp>
 #include <boost/date_time.hpp>
-#include <boost/asio.hpp>
 
 #include <sys/socket.h>
 #include <netinet/in.h>
 #include <arpa/inet.h>
+#include <netdb.h>
+#include <sys/epoll.h>
+#include <fcntl.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <cerrno>
+#include <cstring>
+#include <fstream>
+#include <poll.h>
 
 #include <openssl/bio.h> // BIO objects for I/O
 #include <openssl/ssl.h> // SSL and SSL_CTX for SSL connections
 #include <openssl/err.h> // Error reporting
 
 
-Client::Client(int argc, char** argv) {
+Client::Client(int argc, char** argv) 
+    : ssl(NULL),
+      sock(-1),
+      fullHandshakes(0),
+      resumedHandshakes(0),
+      awaitingReply(false)
+{
     parseOptions(argc, argv);
 
     /* Initializing OpenSSL */
@@ -27,17 +42,29 @@ Client::Client(int argc, char** argv) {
     ERR_load_BIO_strings();
     OpenSSL_add_all_algorithms();
     
-    meth = SSLv3_method();
+    meth = TLS_client_method();
     ctx = SSL_CTX_new(meth);
     if (NULL == ctx) {
         std::cerr << "unable to create SSL ctx" << std::endl;
         abort();
     }
+    /* kernel TLS, tickets and SNI routing all need TLS 1.2 or later */
+    SSL_CTX_set_min_proto_version(ctx, TLS1_2_VERSION);
 
     /* Load the RSA CA certificate into the SSL_CTX structure */
     /* This will allow this client to verify the server's     */
     /* certificate.                                           */
     
+    /* post-handshake records (session tickets) must not block SSL_read */
+    SSL_CTX_clear_mode(ctx, SSL_MODE_AUTO_RETRY);
+
+    /* keep sessions ourselves so they can be resumed on the next connect */
+    SSL_CTX_set_session_cache_mode(ctx, SSL_SESS_CACHE_CLIENT | SSL_SESS_CACHE_NO_INTERNAL_STORE);
+    SSL_CTX_sess_set_new_cb(ctx, &Client::newSession);
+    if (!sessionFile.empty()) {
+        loadSessions();
+    }
+
     const std::string RSA_CLIENT_CA_CERT("./cluster.cert");
     if (!SSL_CTX_load_verify_locations(ctx, RSA_CLIENT_CA_CERT.c_str(), NULL)) {
         ERR_print_errors_fp(stderr);
@@ -47,129 +74,597 @@ Client::Client(int argc, char** argv) {
 
 }
 
-void Client::run() {
-    fd_set fds;
-    FD_ZERO(&fds);
-
-    FD_SET(STDIN_FILENO, &fds);
-    int fdMax = STDIN_FILENO;
-
-    sockaddr_storage connectorAddr;
-    bzero((void *) &connectorAddr, sizeof(connectorAddr));    
-    boost::asio::ip::address connectorIp = boost::asio::ip::address::from_string(connectorAddress) ;
+inline uint64_t monotonicMillis() {
+    timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return uint64_t(now.tv_sec) * 1000 + now.tv_nsec / 1000000;
+}
 
-    int family = AF_INET;
-    if (connectorIp.is_v6()) {
-        family=AF_INET6;
+inline void addToEpoll(int newFd, int epollFd, uint32_t events) {
+    epoll_event  event;
+    event.events = events;
+    event.data.fd = newFd;
+    if (epoll_ctl(epollFd, EPOLL_CTL_ADD, newFd, &event) != 0) {
+        perror("epoll_ctr add fd failed.");
+        abort();
     }
-    int sock = socket(family, SOCK_STREAM, IPPROTO_TCP);
-    if (sock == -1) perror("Socket");
+}
 
-    if (connectorIp.is_v4()) {
-        sockaddr_in& sockAddr = *reinterpret_cast<sockaddr_in*>(&connectorAddr);
-        sockAddr.sin_family = AF_INET;
-        sockAddr.sin_port = htons(connectPort);
-        inet_pton(sockAddr.sin_family, connectorAddress.c_str(), &(sockAddr.sin_addr.s_addr));
+void Client::run() {
+    std::vector<sockaddr_storage> candidates = resolveConnectors();
+    if (candidates.empty()) {
+        std::cerr << "no usable connector address" << std::endl;
+        abort();
     }
-
-    if (connectorIp.is_v6()) {
-        sockaddr_in6& sockAddr = *reinterpret_cast<sockaddr_in6*>(&connectorAddr);
-        sockAddr.sin6_family = AF_INET6;
-        sockAddr.sin6_port = htons(connectPort);
-        inet_pton(sockAddr.sin6_family, connectorAddress.c_str(), &(sockAddr.sin6_addr));
+    if (handshakes > 0) {
+        runHandshakeBenchmark(candidates);
+        return;
     }
 
-    if (-1 == connect(sock, (struct sockaddr *)&connectorAddr, sizeof(connectorAddr))) {
-        perror("Connect");
+    sock = udp ? connectUdp(candidates) : connectFastest(candidates);
+    if (sock < 0) {
+        std::cerr << "unable to connect to any connector address" << std::endl;
         abort();
     }
-    std::stringstream registration;
-    registration << identifier << " " << secure;
-    send(sock, registration.str().c_str(), registration.str().size(), 0); 
+    std::cout << "Connected to " << connectedPeer << std::endl;
 
-    FD_SET(sock, &fds);
-    if (sock > fdMax) { fdMax = sock; }
+    if (udp) {
+        // later datagrams must not race the connector's flow setup
+        if (!registerUdp()) {
+            close(sock);
+            exit(1);
+        }
+        if (pings > 0) {
+            runUdpBenchmark();
+            close(sock);
+            return;
+        }
+    } else if (serverName.empty()) {
+        // the connector only consumes the registration line, so plain text
+        // input can follow it without waiting for the reply
+        registerWithConnector();
+        awaitingReply = true;
+    } else {
+        // the connector routes on the ClientHello itself
+        startTls();
+        std::cout << "TLS handshake " << (SSL_session_reused(ssl) ? "resumed" : "full") << std::endl;
+    }
 
-    while(1) {
-        fd_set readfds = fds;
-        int rc = select(fdMax+1, &readfds, NULL, NULL, NULL);        
+    int epollFd = epoll_create1(0);
+    addToEpoll(STDIN_FILENO, epollFd, EPOLLIN);
+    addToEpoll(sock, epollFd, EPOLLIN);
+
+    bool connected = true;
+    bool inputDone = false;
+    while(connected) {
+        epoll_event events[2];
+        // a datagram flow has no close, wait a little for the last answers
+        int rc = epoll_wait(epollFd, events, 2, (udp && inputDone) ? 1000 : -1);
         if (rc == -1) {
-            perror("Select failure");
+            if (errno == EINTR) continue;
+            perror("epoll failure");
             break;
         }
+        if (rc == 0) break;
         
         // run through connections looking for data to read
-        for (int i = 0; i < fdMax+1; i++) {
-            if (FD_ISSET(i, &readfds)) {
-                if (i  == sock) {
-                    // handle server information
-                    static const unsigned int messageLength = 200; 
-                    char message[messageLength];
-                    int in = recv(i, &message, messageLength-1, 0);
-                    message[in]='\0';
-                    if (in > 0) {
-                        std::cout << message << std::endl;
-                        if (secure == true) { 
-                            ssl = SSL_new(ctx);
-                            if (NULL == ssl) {
-                                std::cerr << "unable to create new SSL connection" << std::endl;
-                                abort();
-                            }                        
-                            // flag it as client side
-                            SSL_set_connect_state(ssl);
-
-                            int err = SSL_set_fd(ssl, sock);
-                            if (err == 0) {
-                                std::cerr << "unable to set socket into ssl structure" << std::endl;
-                                abort();
-                            }
-                            /* Perform SSL Handshake on the SSL client */
-                            err = SSL_connect(ssl);                        
-                            if (err == 0) {
-                                std::cerr << "unable to negotiate ssl handshake" << std::endl;
-                                abort();
-                            }
-                        }
-                    } else {
-                        if (in <= 0) {
-                            std::cout << "connection error or closed" << std::endl;
-                            close(i);
-                            break;
-                        }
-                    }
-                }
-                if (i == STDIN_FILENO) {
-                    static const unsigned int MAXLINE=200;
-                    char buf[MAXLINE];
-                    std::cin.getline(buf, MAXLINE);
-                    int bufSize = strlen(buf);
-                    if (buf[bufSize] == '\n') {
-                        buf[bufSize] = '\0';
-                        bufSize--;
-                    }
-                    if (bufSize > 0) {
-                        if (secure == true) {
-                            int bytesWritten  = SSL_write(ssl, buf, bufSize);
-                            if (bytesWritten == 0) {
-                                std::cerr << "unable to write secure data" << std::endl; 
-                            }
-                        } else {
-                            send(sock, buf, bufSize, 0);
-                        }
-                    }
+        for (int i = 0; i < rc && connected; i++) {
+            if (events[i].data.fd == sock) {
+                connected = readConnector();
+            } else if (events[i].data.fd == STDIN_FILENO) {
+                if (!readInput()) {
+                    epoll_ctl(epollFd, EPOLL_CTL_DEL, STDIN_FILENO, NULL);
+                    inputDone = true;
+                    // an empty datagram ends the flow on the worker
+                    if (udp) send(sock, "", 0, 0);
                 }
             }
         }
     }
         
+    if (ssl != NULL) {
+        SSL_shutdown(ssl);
+        SSL_free(ssl);
+    }
+    close(epollFd);
     close(sock);
 }
 
+void Client::registerWithConnector() {
+    std::stringstream registration;
+    registration << identifier << " " << secure << "\n";
+    send(sock, registration.str().c_str(), registration.str().size(), 0); 
+}
+
+bool Client::readConnector() {
+    // handle server information
+    static const unsigned int messageLength = 200; 
+    char message[messageLength];
+    int in = 0;
+    if (ssl != NULL) {
+        in = SSL_read(ssl, message, messageLength-1);
+        if (in <= 0 && SSL_get_error(ssl, in) == SSL_ERROR_WANT_READ) return true;
+    } else {
+        in = recv(sock, &message, messageLength-1, 0);
+    }
+    if (in <= 0) {
+        std::cout << "connection error or closed" << std::endl;
+        return false;
+    }
+    // replies are lines, the last newline comes from endl
+    if (message[in-1] == '\n') in--;
+    message[in]='\0';
+    std::cout << message << std::endl;
+
+    if (awaitingReply) {
+        awaitingReply = false;
+        if (strncmp(message, "Failed", 6) == 0) {
+            // the connector closes the socket after a refusal, there is no TLS to start
+            std::cout << "registration refused" << std::endl;
+            return false;
+        }
+        if (secure == true) {
+            startTls();
+            std::cout << "TLS handshake " << (SSL_session_reused(ssl) ? "resumed" : "full") << std::endl;
+            if (!pendingInput.empty()) {
+                sendData(pendingInput.data(), pendingInput.size());
+                pendingInput.clear();
+            }
+        }
+    }
+    return true;
+}
+
+void Client::startTls() {
+    ssl = SSL_new(ctx);
+    if (NULL == ssl) {
+        std::cerr << "unable to create new SSL connection" << std::endl;
+        abort();
+    }                        
+    // flag it as client side
+    SSL_set_connect_state(ssl);
+
+    int err = SSL_set_fd(ssl, sock);
+    if (err == 0) {
+        std::cerr << "unable to set socket into ssl structure" << std::endl;
+        abort();
+    }
+    SSL_set_app_data(ssl, this);
+    if (!serverName.empty()) {
+        SSL_set_tlsext_host_name(ssl, serverName.c_str());
+    }
+    SSL_SESSION* offered = NULL;
+    SessionCache::iterator cached = sessions.find(sessionKey());
+    if (cached != sessions.end()) {
+        offered = cached->second;
+        SSL_set_session(ssl, offered);
+    }
+    /* Perform SSL Handshake on the SSL client */
+    err = SSL_connect(ssl);                        
+    if (err <= 0) {
+        std::cerr << "unable to negotiate ssl handshake" << std::endl;
+        ERR_print_errors_fp(stderr);
+        abort();
+    }
+    if (SSL_session_reused(ssl)) {
+        resumedHandshakes++;
+    } else {
+        fullHandshakes++;
+        // the connector or worker no longer knows the offered session; up
+        // to TLS 1.2 newSession() may have replaced it during the handshake
+        cached = sessions.find(sessionKey());
+        if (offered != NULL && cached != sessions.end() && cached->second == offered) {
+            SSL_SESSION_free(cached->second);
+            sessions.erase(cached);
+            if (!sessionFile.empty()) {
+                saveSessions();
+            }
+        }
+    }
+}
+
+std::string Client::sessionKey() const {
+    std::stringstream key;
+    key << connectedPeer << "/" << (serverName.empty() ? "" : serverName + "/") << identifier;
+    return key.str();
+}
+
+int Client::newSession(SSL* ssl, SSL_SESSION* session) {
+    Client* client = static_cast<Client*>(SSL_get_app_data(ssl));
+    if (client == NULL || !SSL_SESSION_is_resumable(session)) return 0;
+    std::string key = client->sessionKey();
+    SessionCache::iterator old = client->sessions.find(key);
+    if (old != client->sessions.end()) {
+        SSL_SESSION_free(old->second);
+        old->second = session;
+    } else {
+        client->sessions[key] = session;
+    }
+    if (!client->sessionFile.empty()) {
+        client->saveSessions();
+    }
+    // we keep the reference
+    return 1;
+}
+
+void Client::loadSessions() {
+    std::ifstream in(sessionFile.c_str());
+    std::string key;
+    std::string hex;
+    time_t now = time(NULL);
+    while (in >> key >> hex) {
+        std::vector<unsigned char> der(hex.size() / 2);
+        for (size_t i = 0; i < der.size(); i++) {
+            der[i] = strtoul(hex.substr(2 * i, 2).c_str(), NULL, 16);
+        }
+        const unsigned char* ptr = der.empty() ? NULL : &der[0];
+        SSL_SESSION* session = d2i_SSL_SESSION(NULL, &ptr, der.size());
+        if (session == NULL) continue;
+        if (SSL_SESSION_get_time(session) + SSL_SESSION_get_timeout(session) < now) {
+            SSL_SESSION_free(session);
+            continue;
+        }
+        SessionCache::iterator old = sessions.find(key);
+        if (old != sessions.end()) SSL_SESSION_free(old->second);
+        sessions[key] = session;
+    }
+}
+
+void Client::saveSessions() {
+    // write a new file and move it over the old one
+    std::string temporary = sessionFile + ".tmp";
+    std::ofstream out(temporary.c_str(), std::ios::trunc);
+    for (SessionCache::const_iterator iter = sessions.begin(); iter != sessions.end(); ++iter) {
+        int length = i2d_SSL_SESSION(iter->second, NULL);
+        if (length <= 0) continue;
+        std::vector<unsigned char> der(length);
+        unsigned char* ptr = &der[0];
+        i2d_SSL_SESSION(iter->second, &ptr);
+        out << iter->first << " ";
+        char digits[3];
+        for (int i = 0; i < length; i++) {
+            snprintf(digits, sizeof(digits), "%02x", der[i]);
+            out << digits;
+        }
+        out << "\n";
+    }
+    out.close();
+    if (!out || rename(temporary.c_str(), sessionFile.c_str()) != 0) {
+        perror("unable to save TLS sessions");
+    }
+}
+
+void Client::runHandshakeBenchmark(const std::vector<sockaddr_storage>& candidates) {
+    if (!secure) {
+        std::cerr << "--handshakes needs --secure" << std::endl;
+        exit(4);
+    }
+    double fullMillis = 0;
+    double resumedMillis = 0;
+    for (unsigned int i = 0; i < handshakes; i++) {
+        sock = connectFastest(candidates);
+        if (sock < 0) {
+            std::cerr << "unable to connect to any connector address" << std::endl;
+            abort();
+        }
+        if (serverName.empty()) {
+            registerWithConnector();
+            static const unsigned int messageLength = 200; 
+            char message[messageLength];
+            int in = recv(sock, message, messageLength-1, 0);
+            if (in <= 0 || strncmp(message, "Failed", 6) == 0) {
+                std::cerr << "registration failed" << std::endl;
+                abort();
+            }
+        }
+
+        timespec start;
+        timespec end;
+        clock_gettime(CLOCK_MONOTONIC, &start);
+        startTls();
+        clock_gettime(CLOCK_MONOTONIC, &end);
+        double millis = (end.tv_sec - start.tv_sec) * 1000.0 + (end.tv_nsec - start.tv_nsec) / 1e6;
+        if (SSL_session_reused(ssl)) {
+            resumedMillis += millis;
+        } else {
+            fullMillis += millis;
+        }
+
+        // TLS 1.3 tickets follow the handshake, pick them up before closing
+        pollfd ready;
+        ready.fd = sock;
+        ready.events = POLLIN;
+        if (SSL_version(ssl) >= TLS1_3_VERSION && poll(&ready, 1, 100) > 0) {
+            char ignored[1];
+            SSL_read(ssl, ignored, sizeof(ignored));
+        }
+
+        SSL_shutdown(ssl);
+        SSL_free(ssl);
+        ssl = NULL;
+        close(sock);
+    }
+
+    unsigned int total = fullHandshakes + resumedHandshakes;
+    printf("handshakes: %u full: %u resumed: %u resumption rate: %.1f%%\n",
+           total, fullHandshakes, resumedHandshakes,
+           total ? 100.0 * resumedHandshakes / total : 0.0);
+    printf("average handshake full: %.3f ms resumed: %.3f ms\n",
+           fullHandshakes ? fullMillis / fullHandshakes : 0.0,
+           resumedHandshakes ? resumedMillis / resumedHandshakes : 0.0);
+}
+
+int Client::connectUdp(const std::vector<sockaddr_storage>& candidates) {
+    // nothing to race without a handshake, the first usable address wins
+    for (size_t i = 0; i < candidates.size(); i++) {
+        const sockaddr_storage& addr = candidates[i];
+        socklen_t length = (addr.ss_family == AF_INET6) ? sizeof(sockaddr_in6) : sizeof(sockaddr_in);
+        int fd = socket(addr.ss_family, SOCK_DGRAM, IPPROTO_UDP);
+        if (fd == -1) {
+            perror("Socket");
+            continue;
+        }
+        if (connect(fd, reinterpret_cast<const sockaddr*>(&addr), length) != 0) {
+            perror("Connect");
+            close(fd);
+            continue;
+        }
+        notePeer(fd);
+        return fd;
+    }
+    return -1;
+}
+
+bool Client::registerUdp() {
+    // the registration or its answer may get lost, so ask a few times
+    static const int attempts = 3;
+    static const int timeoutMs = 1000;
+    for (int i = 0; i < attempts; i++) {
+        registerWithConnector();
+        pollfd ready;
+        ready.fd = sock;
+        ready.events = POLLIN;
+        if (poll(&ready, 1, timeoutMs) <= 0) continue;
+        static const unsigned int messageLength = 200;
+        char message[messageLength];
+        int in = recv(sock, message, messageLength-1, 0);
+        if (in < 0) {
+            perror("udp registration");
+            return false;
+        }
+        message[in]='\0';
+        std::cout << message << std::endl;
+        return strncmp(message, "Failed", 6) != 0;
+    }
+    std::cerr << "no answer to the udp registration" << std::endl;
+    return false;
+}
+
+void Client::runUdpBenchmark() {
+    std::vector<char> ping(pingSize, 'x');
+    std::vector<char> echo(65536);
+    std::vector<double> micros;
+    micros.reserve(pings);
+    unsigned int lost = 0;
+    static const int timeoutMs = 1000;
+    for (uint32_t sequence = 0; sequence < pings; sequence++) {
+        // the sequence number tells a late echo from the awaited one
+        memcpy(&ping[0], &sequence, sizeof(sequence));
+        timespec start;
+        timespec end;
+        clock_gettime(CLOCK_MONOTONIC, &start);
+        if (send(sock, &ping[0], ping.size(), 0) < 0) {
+            perror("udp send");
+            break;
+        }
+        bool answered = false;
+        pollfd ready;
+        ready.fd = sock;
+        ready.events = POLLIN;
+        while (!answered && poll(&ready, 1, timeoutMs) > 0) {
+            int in = recv(sock, &echo[0], echo.size(), 0);
+            if (in < 0) break;
+            answered = (size_t(in) == ping.size() && memcmp(&echo[0], &sequence, sizeof(sequence)) == 0);
+        }
+        if (!answered) {
+            lost++;
+            continue;
+        }
+        clock_gettime(CLOCK_MONOTONIC, &end);
+        micros.push_back((end.tv_sec - start.tv_sec) * 1e6 + (end.tv_nsec - start.tv_nsec) / 1e3);
+    }
+    // ends the flow on the worker
+    send(sock, "", 0, 0);
+
+    std::sort(micros.begin(), micros.end());
+    double total = 0;
+    for (size_t i = 0; i < micros.size(); i++) total += micros[i];
+    printf("udp pings: %u size: %u answered: %zu lost: %u\n", pings, pingSize, micros.size(), lost);
+    if (micros.empty()) return;
+    printf("round trip avg: %.1f us p50: %.1f us p99: %.1f us max: %.1f us\n",
+           total / micros.size(), micros[micros.size() / 2],
+           micros[micros.size() * 99 / 100], micros.back());
+}
+
+bool Client::readInput() {
+    char buf[4096];
+    ssize_t in = read(STDIN_FILENO, buf, sizeof(buf));
+    if (in <= 0) {
+        // end of input: whatever is left is the last line
+        if (!partialLine.empty()) {
+            partialLine += '\n';
+            sendData(partialLine.data(), partialLine.size());
+            partialLine.clear();
+        }
+        return false;
+    }
+    partialLine.append(buf, in);
+    size_t start = 0;
+    size_t end;
+    while ((end = partialLine.find('\n', start)) != std::string::npos) {
+        // the worker frames messages by their newline
+        if (end > start) {
+            sendData(&partialLine[start], end - start + 1);
+        }
+        start = end + 1;
+    }
+    partialLine.erase(0, start);
+    return true;
+}
+
+void Client::sendData(const char* data, size_t length) {
+    if (secure == true) {
+        if (ssl == NULL) {
+            pendingInput.append(data, length);
+            return;
+        }
+        int bytesWritten  = SSL_write(ssl, data, length);
+        if (bytesWritten <= 0) {
+            std::cerr << "unable to write secure data" << std::endl; 
+        }
+    } else {
+        send(sock, data, length, 0);
+    }
+}
+
+std::vector<sockaddr_storage> Client::resolveConnectors() {
+    std::vector<sockaddr_storage> v4;
+    std::vector<sockaddr_storage> v6;
+    int firstFamily = AF_UNSPEC;
+
+    char port[16];
+    snprintf(port, sizeof(port), "%u", connectPort);
+    for (std::vector<std::string>::const_iterator name = connectorAddresses.begin();
+         name != connectorAddresses.end();
+         ++name) {
+        addrinfo hints;
+        memset(&hints, 0, sizeof(hints));
+        hints.ai_family = AF_UNSPEC;
+        hints.ai_socktype = SOCK_STREAM;
+        hints.ai_protocol = IPPROTO_TCP;
+        addrinfo* results = NULL;
+        int rc = getaddrinfo(name->c_str(), port, &hints, &results);
+        if (rc != 0) {
+            std::cerr << "unable to resolve " << *name << ": " << gai_strerror(rc) << std::endl;
+            continue;
+        }
+        for (addrinfo* ai = results; ai != NULL; ai = ai->ai_next) {
+            sockaddr_storage addr;
+            memset(&addr, 0, sizeof(addr));
+            memcpy(&addr, ai->ai_addr, ai->ai_addrlen);
+            if (firstFamily == AF_UNSPEC) firstFamily = ai->ai_family;
+            if (ai->ai_family == AF_INET6) v6.push_back(addr);
+            if (ai->ai_family == AF_INET) v4.push_back(addr);
+        }
+        freeaddrinfo(results);
+    }
+
+    // alternate the families, starting with the one resolved first
+    std::vector<sockaddr_storage>& first = (firstFamily == AF_INET6) ? v6 : v4;
+    std::vector<sockaddr_storage>& second = (firstFamily == AF_INET6) ? v4 : v6;
+    std::vector<sockaddr_storage> ordered;
+    for (size_t i = 0; i < first.size() || i < second.size(); i++) {
+        if (i < first.size()) ordered.push_back(first[i]);
+        if (i < second.size()) ordered.push_back(second[i]);
+    }
+    return ordered;
+}
+
+int Client::connectFastest(const std::vector<sockaddr_storage>& candidates) {
+    // happy eyeballs: start the next attempt when the previous one fails or
+    // has not finished within connectDelay, the first to complete wins
+    int raceFd = epoll_create1(0);
+    std::vector<int> attempts;
+    size_t next = 0;
+    int winner = -1;
+    uint64_t nextStart = monotonicMillis();
+
+    while (winner < 0) {
+        uint64_t now = monotonicMillis();
+        if (next < candidates.size() && (attempts.empty() || now >= nextStart)) {
+            const sockaddr_storage& addr = candidates[next++];
+            socklen_t length = (addr.ss_family == AF_INET6) ? sizeof(sockaddr_in6) : sizeof(sockaddr_in);
+            int fd = socket(addr.ss_family, SOCK_STREAM | SOCK_NONBLOCK, IPPROTO_TCP);
+            if (fd == -1) {
+                perror("Socket");
+                continue;
+            }
+            if (connect(fd, reinterpret_cast<const sockaddr*>(&addr), length) == 0) {
+                winner = fd;
+                break;
+            }
+            if (errno != EINPROGRESS) {
+                perror("Connect");
+                close(fd);
+                continue;
+            }
+            addToEpoll(fd, raceFd, EPOLLOUT);
+            attempts.push_back(fd);
+            nextStart = now + connectDelay;
+            continue;
+        }
+        if (attempts.empty()) break;
+
+        int timeout = -1;
+        if (next < candidates.size()) timeout = nextStart > now ? nextStart - now : 0;
+        epoll_event events[8];
+        int rc = epoll_wait(raceFd, events, 8, timeout);
+        if (rc < 0 && errno != EINTR) {
+            perror("epoll failure");
+            break;
+        }
+        for (int i = 0; i < rc && winner < 0; i++) {
+            int fd = events[i].data.fd;
+            int error = 0;
+            socklen_t errorLength = sizeof(error);
+            getsockopt(fd, SOL_SOCKET, SO_ERROR, &error, &errorLength);
+            attempts.erase(std::find(attempts.begin(), attempts.end(), fd));
+            if (error == 0) {
+                winner = fd;
+            } else {
+                errno = error;
+                perror("Connect");
+                close(fd);
+                nextStart = now;
+            }
+        }
+    }
+
+    for (size_t i = 0; i < attempts.size(); i++) close(attempts[i]);
+    close(raceFd);
+    if (winner < 0) return winner;
+
+    // the rest of the client does blocking I/O
+    int flags = fcntl(winner, F_GETFL, 0);
+    fcntl(winner, F_SETFL, flags & ~O_NONBLOCK);
+    notePeer(winner);
+    return winner;
+}
+
+void Client::notePeer(int fd) {
+    sockaddr_storage peer;
+    socklen_t peerLength = sizeof(peer);
+    char peerName[INET6_ADDRSTRLEN] = "?";
+    if (getpeername(fd, reinterpret_cast<sockaddr*>(&peer), &peerLength) == 0) {
+        const void* ip = (peer.ss_family == AF_INET6)
+            ? static_cast<const void*>(&reinterpret_cast<sockaddr_in6*>(&peer)->sin6_addr)
+            : static_cast<const void*>(&reinterpret_cast<sockaddr_in*>(&peer)->sin_addr);
+        inet_ntop(peer.ss_family, ip, peerName, sizeof(peerName));
+    }
+    std::stringstream peerText;
+    peerText << peerName << ":" << connectPort;
+    connectedPeer = peerText.str();
+}
+
 
 void Client::parseOptions(int argc, char** argv) {
         
     connectPort = 6789;
-    connectorAddress = "127.0.0.1";
+    connectDelay = 250;
+    handshakes = 0;
+    udp = false;
+    pings = 0;
+    pingSize = 64;
     secure = false;
     identifier = 123456;
     try {
@@ -178,8 +673,15 @@ void Client::parseOptions(int argc, char** argv) {
         ("help", "print help messages")
         ("identifier,id", boost::program_options::value<unsigned int>(&identifier), "identifier used for communications")
         ("port,p", boost::program_options::value<unsigned int>(&connectPort), "port to connect to")
-        ("ip,i", boost::program_options::value<std::string>(&connectorAddress), "port to connect to")
+        ("ip,i", boost::program_options::value<std::vector<std::string> >(&connectorAddresses)->composing(), "connector address or host name, may be repeated")
+        ("connectDelay", boost::program_options::value<unsigned int>(&connectDelay), "ms before racing the next connector address")
         ("secure,s", boost::program_options::bool_switch(&secure), "use ssl for communications")
+        ("sni", boost::program_options::value<std::string>(&serverName), "start TLS directly, routed by this server name (needs --secure)")
+        ("sessionFile", boost::program_options::value<std::string>(&sessionFile), "file keeping TLS sessions between runs")
+        ("udp", boost::program_options::bool_switch(&udp), "send each input line as a datagram of a UDP flow")
+        ("pings", boost::program_options::value<unsigned int>(&pings), "benchmark: with --udp, time this many echoed datagrams")
+        ("pingSize", boost::program_options::value<unsigned int>(&pingSize), "datagram size in bytes for --pings")
+        ("handshakes", boost::program_options::value<unsigned int>(&handshakes), "benchmark: reconnect this many times and report handshake resumption")
         ;
         try {
             store(parse_command_line(argc, argv, desc), options_map);
@@ -188,6 +690,21 @@ void Client::parseOptions(int argc, char** argv) {
                 exit(4);
             }
             notify(options_map);
+            if (connectorAddresses.empty()) {
+                connectorAddresses.push_back("127.0.0.1");
+            }
+            if (!serverName.empty() && !secure) {
+                std::cout << "--sni needs --secure" << std::endl;
+                exit(4);
+            }
+            if (udp && secure) {
+                std::cout << "--udp flows are plain text only" << std::endl;
+                exit(4);
+            }
+            if (pingSize < sizeof(uint32_t) || pingSize > 65507) {
+                std::cout << "--pingSize must be between 4 and 65507" << std::endl;
+                exit(4);
+            }
         }
         catch (const boost::program_options::error& e) {
             std::cout << "some parse error " << e.what() << std::endl; 
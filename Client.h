@@ -6,6 +6,9 @@
 
 #include <boost/program_options.hpp>
 #include <string>
+#include <map>
+#include <vector>
+#include <sys/socket.h>
 
 class Client {
 public:
@@ -15,13 +18,40 @@ public:
 private:
     // methods
     void parseOptions(int argc, char** argv);
+    std::vector<sockaddr_storage> resolveConnectors();
+    int  connectFastest(const std::vector<sockaddr_storage>& candidates);
+    void notePeer(int fd);
+    void startTls();
+    void registerWithConnector();
+    bool readInput();
+    bool readConnector();
+    void sendData(const char* data, size_t length);
+    void runHandshakeBenchmark(const std::vector<sockaddr_storage>& candidates);
 
-private:    
+    // --udp: one connected datagram socket, registered by its first datagram
+    int  connectUdp(const std::vector<sockaddr_storage>& candidates);
+    bool registerUdp();
+    void runUdpBenchmark();
+
+    // TLS session cache, keyed by connector address and identifier
+    std::string sessionKey() const;
+    static int newSession(SSL* ssl, SSL_SESSION* session);
+    void loadSessions();
+    void saveSessions();
+
+private:
     // variables
     unsigned int identifier;
     unsigned int connectPort;
-    std::string connectorAddress;
+    std::vector<std::string> connectorAddresses;
+    unsigned int connectDelay;
     bool secure;
+    std::string serverName;     // direct TLS with SNI, no registration preamble
+    std::string sessionFile;
+    unsigned int handshakes;
+    bool udp;
+    unsigned int pings;
+    unsigned int pingSize;
 
     // Parsed argument values
     boost::program_options::variables_map options_map;
@@ -30,6 +60,17 @@ private:
     SSL            *ssl;
     const SSL_METHOD      *meth;
 
+    int sock;
+    std::string connectedPeer;
+    typedef std::map<std::string, SSL_SESSION*> SessionCache;
+    SessionCache sessions;
+    unsigned int fullHandshakes;
+    unsigned int resumedHandshakes;
+    bool awaitingReply;
+    // input typed before the secure session is up
+    std::string pendingInput;
+    std::string partialLine;
+
 };
 
 
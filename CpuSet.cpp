@@ -0,0 +1,71 @@
+#include "CpuSet.h"
+
+#include <cstdio>
+#include <cstdlib>
+#include <fstream>
+#include <sstream>
+
+#include <sched.h>
+
+bool CpuSet::parse(const std::string& list) {
+    cpus.clear();
+    std::stringstream ranges(list);
+    std::string range;
+    while (std::getline(ranges, range, ',')) {
+        unsigned int first = 0;
+        unsigned int last = 0;
+        char extra;
+        int fields = sscanf(range.c_str(), "%u-%u%c", &first, &last, &extra);
+        if (fields == 1) {
+            last = first;
+        } else if (fields != 2 || last < first) {
+            return false;
+        }
+        if (last >= CPU_SETSIZE) return false;
+        for (unsigned int cpu = first; cpu <= last; cpu++) cpus.push_back(cpu);
+    }
+    return !cpus.empty();
+}
+
+bool CpuSet::pin() const {
+    cpu_set_t set;
+    CPU_ZERO(&set);
+    for (size_t i = 0; i < cpus.size(); i++) CPU_SET(cpus[i], &set);
+    // pid 0 is the calling thread
+    if (sched_setaffinity(0, sizeof(set), &set) != 0) {
+        perror("unable to set cpu affinity");
+        return false;
+    }
+    return true;
+}
+
+int CpuSet::current() {
+    return sched_getcpu();
+}
+
+int CpuSet::nodeOf(int cpu) {
+    // read once from sysfs; machines without NUMA have only node0
+    static std::vector<int> nodes;
+    static bool loaded = false;
+    if (!loaded) {
+        loaded = true;
+        static const int maxNodes = 256;
+        for (int node = 0; node < maxNodes; node++) {
+            std::stringstream path;
+            path << "/sys/devices/system/node/node" << node << "/cpulist";
+            std::ifstream in(path.str().c_str());
+            if (!in) continue;
+            std::string list;
+            std::getline(in, list);
+            CpuSet members;
+            if (!members.parse(list)) continue;
+            for (size_t i = 0; i < members.cpus.size(); i++) {
+                int member = members.cpus[i];
+                if (size_t(member) >= nodes.size()) nodes.resize(member + 1, -1);
+                nodes[member] = node;
+            }
+        }
+    }
+    if (cpu < 0 || size_t(cpu) >= nodes.size()) return -1;
+    return nodes[cpu];
+}
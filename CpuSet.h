@@ -0,0 +1,29 @@
+#ifndef CPUSET_H
+#define CPUSET_H
+
+#include <string>
+#include <vector>
+
+// A list of CPUs given on the command line ("0-3,8") and the topology
+// lookups the connector and workers need for placing work near the core
+// that handled a socket's packets.
+class CpuSet {
+public:
+    // accepts the kernel's cpulist format
+    bool parse(const std::string& list);
+    bool empty() const { return cpus.empty(); }
+    const std::vector<int>& members() const { return cpus; }
+
+    // restrict the calling thread; threads it starts later inherit the set
+    bool pin() const;
+
+    // cpu the calling thread runs on, -1 when unknown
+    static int current();
+    // NUMA node of cpu, -1 when unknown
+    static int nodeOf(int cpu);
+
+private:
+    std::vector<int> cpus;
+};
+
+#endif
@@ -0,0 +1,50 @@
+#ifndef FDTABLE_H
+#define FDTABLE_H
+
+#include <cstddef>
+#include <memory>
+#include <vector>
+
+// Dense table of per-descriptor records indexed by the fd itself.  The
+// kernel hands out the lowest free descriptor, so the table stays compact
+// and a lookup is a bounds check plus an array access.  Records live on
+// the heap: growing the index never moves them, so buffers they own keep
+// their addresses (SSL_write retries and MSG_ZEROCOPY depend on that).
+template<typename T>
+class FdTable {
+public:
+    FdTable() : used(0) {}
+
+    T* find(int fd) {
+        if (fd < 0 || size_t(fd) >= slots.size()) return NULL;
+        return slots[fd].get();
+    }
+
+    // a fresh default-constructed record for fd
+    T& insert(int fd) {
+        if (size_t(fd) >= slots.size()) {
+            size_t grown = slots.size() * 2;
+            slots.resize(grown > size_t(fd) ? grown : size_t(fd) + 1);
+        }
+        std::unique_ptr<T>& slot = slots[fd];
+        if (!slot) used++;
+        slot.reset(new T());
+        return *slot;
+    }
+
+    void erase(int fd) {
+        if (find(fd) == NULL) return;
+        slots[fd].reset();
+        used--;
+    }
+
+    size_t size() const { return used; }
+    // every fd with a record is below this
+    size_t capacity() const { return slots.size(); }
+
+private:
+    std::vector<std::unique_ptr<T> > slots;
+    size_t used;
+};
+
+#endif
@@ -0,0 +1,180 @@
+#include "HandshakePool.h"
+#include "Logger.h"
+
+#include <algorithm>
+#include <cerrno>
+#include <cstring>
+#include <ctime>
+
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#include <unistd.h>
+
+#include <openssl/ssl.h>
+#include <openssl/err.h>
+
+namespace {
+
+uint64_t monotonicMillis() {
+    timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return uint64_t(now.tv_sec) * 1000 + now.tv_nsec / 1000000;
+}
+
+}
+
+HandshakePool::HandshakePool()
+    : next(0),
+      timeoutMs(0),
+      stopping(false),
+      doneFd(-1)
+{
+}
+
+HandshakePool::~HandshakePool() {
+    stop();
+}
+
+bool HandshakePool::start(unsigned int count, unsigned int timeout) {
+    doneFd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+    if (doneFd < 0) {
+        LOG_ERROR("handshake pool eventfd: {}", strerror(errno));
+        return false;
+    }
+    timeoutMs = timeout;
+    for (unsigned int i = 0; i < count; i++) {
+        Thread* thread = new Thread;
+        thread->epollFd = epoll_create1(EPOLL_CLOEXEC);
+        if (thread->epollFd < 0) {
+            LOG_ERROR("handshake pool epoll: {}", strerror(errno));
+            delete thread;
+            stop();
+            return false;
+        }
+        threads.push_back(thread);
+        thread->thread = std::thread(&HandshakePool::work, this, thread);
+    }
+    return true;
+}
+
+void HandshakePool::stop() {
+    stopping = true;
+    for (size_t i = 0; i < threads.size(); i++) {
+        Thread* thread = threads[i];
+        thread->thread.join();
+        for (size_t j = 0; j < thread->jobs.size(); j++) {
+            SSL_free(thread->jobs[j]->ssl);
+            close(thread->jobs[j]->fd);
+            delete thread->jobs[j];
+        }
+        close(thread->epollFd);
+        delete thread;
+    }
+    threads.clear();
+    // results nobody picked up
+    for (size_t i = 0; i < done.size(); i++) {
+        SSL_free(done[i].ssl);
+        close(done[i].fd);
+    }
+    done.clear();
+    if (doneFd >= 0) {
+        close(doneFd);
+        doneFd = -1;
+    }
+}
+
+void HandshakePool::submit(int fd, SSL* ssl) {
+    Thread* thread = threads[next++ % threads.size()];
+    Job* job = new Job;
+    job->fd = fd;
+    job->ssl = ssl;
+    job->deadline = monotonicMillis() + timeoutMs;
+    {
+        std::lock_guard<std::mutex> lock(thread->jobsMutex);
+        thread->jobs.push_back(job);
+    }
+    // the ClientHello is usually waiting already; one shot keeps a
+    // handshake on one thread at a time while the thread re-arms it
+    epoll_event event;
+    event.events = EPOLLIN | EPOLLONESHOT;
+    event.data.ptr = job;
+    if (epoll_ctl(thread->epollFd, EPOLL_CTL_ADD, fd, &event) != 0) {
+        LOG_ERROR("handshake pool epoll_ctl: {}", strerror(errno));
+        finish(thread, job, false);
+    }
+}
+
+void HandshakePool::takeResults(std::vector<Result>& out) {
+    uint64_t count;
+    if (read(doneFd, &count, sizeof(count)) < 0 && errno != EAGAIN) {
+        LOG_WARN("handshake pool eventfd read: {}", strerror(errno));
+    }
+    std::lock_guard<std::mutex> lock(doneMutex);
+    out.insert(out.end(), done.begin(), done.end());
+    done.clear();
+}
+
+void HandshakePool::work(Thread* self) {
+    static const int maxEvents = 32;
+    static const int tickMs = 100;
+    epoll_event events[maxEvents];
+    while (!stopping) {
+        int count = epoll_wait(self->epollFd, events, maxEvents, tickMs);
+        for (int i = 0; i < count; i++) {
+            advance(self, static_cast<Job*>(events[i].data.ptr));
+        }
+
+        if (timeoutMs == 0) continue;
+        uint64_t now = monotonicMillis();
+        std::vector<Job*> expired;
+        {
+            std::lock_guard<std::mutex> lock(self->jobsMutex);
+            for (size_t i = 0; i < self->jobs.size(); i++) {
+                if (self->jobs[i]->deadline <= now) expired.push_back(self->jobs[i]);
+            }
+        }
+        for (size_t i = 0; i < expired.size(); i++) {
+            LOG_INFO("TLS handshake on socket {} timed out", expired[i]->fd);
+            epoll_ctl(self->epollFd, EPOLL_CTL_DEL, expired[i]->fd, NULL);
+            finish(self, expired[i], false);
+        }
+    }
+}
+
+bool HandshakePool::advance(Thread* self, Job* job) {
+    ERR_clear_error();
+    int rc = SSL_accept(job->ssl);
+    if (rc == 1) {
+        epoll_ctl(self->epollFd, EPOLL_CTL_DEL, job->fd, NULL);
+        finish(self, job, true);
+        return true;
+    }
+    int err = SSL_get_error(job->ssl, rc);
+    if (err == SSL_ERROR_WANT_READ || err == SSL_ERROR_WANT_WRITE) {
+        epoll_event event;
+        event.events = (err == SSL_ERROR_WANT_READ ? EPOLLIN : EPOLLOUT) | EPOLLONESHOT;
+        event.data.ptr = job;
+        if (epoll_ctl(self->epollFd, EPOLL_CTL_MOD, job->fd, &event) == 0) return false;
+    }
+    LOG_INFO("TLS handshake on socket {} failed", job->fd);
+    epoll_ctl(self->epollFd, EPOLL_CTL_DEL, job->fd, NULL);
+    finish(self, job, false);
+    return true;
+}
+
+void HandshakePool::finish(Thread* self, Job* job, bool ok) {
+    {
+        std::lock_guard<std::mutex> lock(self->jobsMutex);
+        self->jobs.erase(std::remove(self->jobs.begin(), self->jobs.end(), job), self->jobs.end());
+    }
+    Result result = { job->fd, job->ssl, ok };
+    delete job;
+    {
+        std::lock_guard<std::mutex> lock(doneMutex);
+        done.push_back(result);
+    }
+    uint64_t one = 1;
+    if (write(doneFd, &one, sizeof(one)) < 0) {
+        LOG_WARN("handshake pool eventfd write: {}", strerror(errno));
+    }
+}
@@ -0,0 +1,66 @@
+#ifndef HANDSHAKEPOOL_H
+#define HANDSHAKEPOOL_H
+
+#include <openssl/ossl_typ.h>
+
+#include <atomic>
+#include <cstdint>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+// Runs server side TLS handshakes on a fixed set of threads so the private
+// key operations stay off the worker's event loop.  Every thread drives its
+// handshakes with non-blocking SSL_accept on its own epoll set.  Finished
+// handshakes, good or bad, are queued for the owner and signalled on an
+// eventfd that the owner's epoll set watches.
+class HandshakePool {
+public:
+    struct Result {
+        int fd;
+        SSL* ssl;
+        bool ok;
+    };
+
+    HandshakePool();
+    ~HandshakePool();
+
+    bool start(unsigned int threads, unsigned int timeoutMs);
+    void stop();
+    bool running() const { return !threads.empty(); }
+    int eventFd() const { return doneFd; }
+
+    // fd must be non-blocking; the pool owns fd and ssl until the result
+    void submit(int fd, SSL* ssl);
+    // appends finished handshakes to out
+    void takeResults(std::vector<Result>& out);
+
+private:
+    struct Job {
+        int fd;
+        SSL* ssl;
+        uint64_t deadline;
+    };
+    struct Thread {
+        int epollFd;
+        std::thread thread;
+        // jobs owned by this thread, for timeouts and shutdown
+        std::mutex jobsMutex;
+        std::vector<Job*> jobs;
+    };
+
+    void work(Thread* self);
+    // true once the handshake is over either way
+    bool advance(Thread* self, Job* job);
+    void finish(Thread* self, Job* job, bool ok);
+
+    std::vector<Thread*> threads;
+    unsigned int next;
+    unsigned int timeoutMs;
+    std::atomic<bool> stopping;
+    int doneFd;
+    std::mutex doneMutex;
+    std::vector<Result> done;
+};
+
+#endif
@@ -0,0 +1,62 @@
+#include "HashRing.h"
+
+#include <algorithm>
+
+namespace {
+
+// splitmix64 finaliser, spreads nearby keys over the whole ring
+inline uint64_t mix(uint64_t value) {
+    value += 0x9e3779b97f4a7c15ull;
+    value = (value ^ (value >> 30)) * 0xbf58476d1ce4e5b9ull;
+    value = (value ^ (value >> 27)) * 0x94d049bb133111ebull;
+    return value ^ (value >> 31);
+}
+
+}
+
+HashRing::HashRing(unsigned int nodes)
+    : virtualNodes(nodes == 0 ? 1 : nodes)
+{
+}
+
+void HashRing::add(int member, uint64_t key) {
+    std::vector<Point> added(virtualNodes);
+    for (unsigned int i = 0; i < virtualNodes; i++) {
+        added[i].position = mix(mix(key) + i);
+        added[i].member = member;
+    }
+    std::sort(added.begin(), added.end());
+
+    size_t middle = points.size();
+    points.insert(points.end(), added.begin(), added.end());
+    std::inplace_merge(points.begin(), points.begin() + middle, points.end());
+}
+
+void HashRing::remove(int member) {
+    std::vector<Point>::iterator end = points.begin();
+    for (std::vector<Point>::iterator iter = points.begin(); iter != points.end(); ++iter) {
+        if (iter->member != member) *end++ = *iter;
+    }
+    points.erase(end, points.end());
+}
+
+int HashRing::lookup(uint64_t hash) const {
+    if (points.empty()) return -1;
+    Point probe;
+    probe.position = hash;
+    probe.member = -1;
+    std::vector<Point>::const_iterator iter = std::lower_bound(points.begin(), points.end(), probe);
+    if (iter == points.end()) iter = points.begin();
+    return iter->member;
+}
+
+uint64_t HashRing::hash(const void* data, size_t length) {
+    // FNV-1a
+    const unsigned char* bytes = static_cast<const unsigned char*>(data);
+    uint64_t value = 0xcbf29ce484222325ull;
+    for (size_t i = 0; i < length; i++) {
+        value ^= bytes[i];
+        value *= 0x100000001b3ull;
+    }
+    return mix(value);
+}
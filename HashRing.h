@@ -0,0 +1,35 @@
+#ifndef HASHRING_H
+#define HASHRING_H
+
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+// Consistent-hash ring with virtual nodes.  Members are placed on the ring
+// by a stable key so a member joining or leaving only moves the share of
+// lookups that land next to its own points.  The ring is kept sorted and
+// changed in place; lookups are a binary search.
+class HashRing {
+public:
+    explicit HashRing(unsigned int virtualNodes = 100);
+
+    void add(int member, uint64_t key);
+    void remove(int member);
+    bool empty() const { return points.empty(); }
+
+    // member owning hash, or -1 when the ring is empty
+    int lookup(uint64_t hash) const;
+
+    static uint64_t hash(const void* data, size_t length);
+
+private:
+    struct Point {
+        uint64_t position;
+        int member;
+        bool operator<(const Point& other) const { return position < other.position; }
+    };
+    std::vector<Point> points;
+    unsigned int virtualNodes;
+};
+
+#endif
@@ -0,0 +1,176 @@
+#include "Logger.h"
+
+#include <cstdio>
+#include <chrono>
+
+// Single-producer/single-consumer ring owned by one logging thread.
+class Logger::Ring {
+public:
+    static const unsigned int capacity = 1024;   // must be a power of two
+
+    Ring() : head(0), tail(0), drops(0) {}
+
+    alignas(64) std::atomic<uint64_t> head;   // written by the owning thread
+    alignas(64) std::atomic<uint64_t> tail;   // written by the writer thread
+    alignas(64) std::atomic<uint64_t> drops;
+    Record slots[capacity];
+};
+
+Logger& Logger::instance() {
+    static Logger logger;
+    return logger;
+}
+
+Logger::Logger()
+    : level(Info),
+      running(true),
+      reportedDrops(0)
+{
+    writer = std::thread(&Logger::writerLoop, this);
+}
+
+Logger::~Logger() {
+    stop();
+}
+
+bool Logger::parseLevel(const std::string& name, Level& out) {
+    if (name == "debug") { out = Debug; return true; }
+    if (name == "info")  { out = Info;  return true; }
+    if (name == "warn")  { out = Warn;  return true; }
+    if (name == "error") { out = Error; return true; }
+    return false;
+}
+
+Logger::Ring& Logger::localRing() {
+    static thread_local Ring* ring = NULL;
+    if (ring == NULL) {
+        ring = new Ring;
+        std::lock_guard<std::mutex> lock(ringsMutex);
+        rings.push_back(ring);
+    }
+    return *ring;
+}
+
+Logger::Record* Logger::claim() {
+    Ring& ring = localRing();
+    uint64_t head = ring.head.load(std::memory_order_relaxed);
+    if (head - ring.tail.load(std::memory_order_acquire) >= Ring::capacity) {
+        ring.drops.fetch_add(1, std::memory_order_relaxed);
+        return NULL;
+    }
+    return &ring.slots[head & (Ring::capacity - 1)];
+}
+
+void Logger::publish() {
+    Ring& ring = localRing();
+    ring.head.store(ring.head.load(std::memory_order_relaxed) + 1, std::memory_order_release);
+}
+
+uint64_t Logger::dropped() const {
+    uint64_t total = 0;
+    std::lock_guard<std::mutex> lock(ringsMutex);
+    for (std::vector<Ring*>::const_iterator iter = rings.begin(); iter != rings.end(); ++iter) {
+        total += (*iter)->drops.load(std::memory_order_relaxed);
+    }
+    return total;
+}
+
+void Logger::stop() {
+    if (!running.exchange(false)) return;
+    wake.notify_all();
+    if (writer.joinable()) writer.join();
+}
+
+bool Logger::drain(std::string& out) {
+    std::vector<Ring*> snapshot;
+    {
+        std::lock_guard<std::mutex> lock(ringsMutex);
+        snapshot = rings;
+    }
+    bool any = false;
+    for (std::vector<Ring*>::iterator iter = snapshot.begin(); iter != snapshot.end(); ++iter) {
+        Ring& ring = **iter;
+        uint64_t tail = ring.tail.load(std::memory_order_relaxed);
+        uint64_t head = ring.head.load(std::memory_order_acquire);
+        for (; tail != head; tail++) {
+            format(ring.slots[tail & (Ring::capacity - 1)], out);
+            any = true;
+        }
+        ring.tail.store(tail, std::memory_order_release);
+    }
+    return any;
+}
+
+void Logger::writerLoop() {
+    static const std::chrono::milliseconds flushInterval(5);
+    std::string batch;
+    batch.reserve(64 * 1024);
+    bool more = true;
+    while (more) {
+        more = running.load();
+        batch.clear();
+        drain(batch);
+
+        uint64_t drops = dropped();
+        if (drops != reportedDrops) {
+            char note[80];
+            snprintf(note, sizeof(note), "logger dropped %llu records\n",
+                     (unsigned long long)(drops - reportedDrops));
+            batch += note;
+            reportedDrops = drops;
+        }
+        if (!batch.empty()) {
+            fwrite(batch.data(), 1, batch.size(), stdout);
+            fflush(stdout);
+            continue;
+        }
+        if (more) {
+            std::unique_lock<std::mutex> lock(wakeMutex);
+            wake.wait_for(lock, flushInterval);
+        }
+    }
+}
+
+void Logger::format(const Record& record, std::string& out) {
+    static const char* levelNames[] = { "DEBUG", "INFO ", "WARN ", "ERROR" };
+
+    char prefix[48];
+    time_t seconds = record.timestamp / 1000000000ull;
+    unsigned int micros = (record.timestamp % 1000000000ull) / 1000;
+    tm local;
+    localtime_r(&seconds, &local);
+    snprintf(prefix, sizeof(prefix), "%02d:%02d:%02d.%06u %s ",
+             local.tm_hour, local.tm_min, local.tm_sec, micros,
+             levelNames[record.level & 3]);
+    out += prefix;
+
+    unsigned int arg = 0;
+    for (const char* ptr = record.format; *ptr; ptr++) {
+        if (ptr[0] != '{' || ptr[1] != '}' || arg >= record.argCount) {
+            out += *ptr;
+            continue;
+        }
+        ptr++;
+        char number[32];
+        const Record::Arg& value = record.args[arg];
+        switch (record.argTypes[arg]) {
+        case Record::Signed:
+            snprintf(number, sizeof(number), "%lld", (long long)value.i);
+            out += number;
+            break;
+        case Record::Unsigned:
+            snprintf(number, sizeof(number), "%llu", (unsigned long long)value.u);
+            out += number;
+            break;
+        case Record::Floating:
+            snprintf(number, sizeof(number), "%g", value.d);
+            out += number;
+            break;
+        case Record::Text:
+            out.append(&record.text[value.s.offset], value.s.length);
+            break;
+        }
+        arg++;
+    }
+    out += '\n';
+}
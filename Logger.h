@@ -0,0 +1,180 @@
+#ifndef LOGGER_H
+#define LOGGER_H
+
+#include <atomic>
+#include <condition_variable>
+#include <cstdint>
+#include <cstring>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <type_traits>
+#include <vector>
+
+#include <time.h>
+
+// Text argument that is not null terminated.
+struct LogBytes {
+    LogBytes(const char* d, size_t l) : data(d), length(l) {}
+    const char* data;
+    size_t length;
+};
+
+// Asynchronous logger.  The calling thread only copies a fixed-size binary
+// record (format pointer plus raw arguments) into its own lock-free ring;
+// a background thread formats the records and writes them out in batches.
+// Format strings must be string literals and use "{}" as placeholder.
+class Logger {
+public:
+    enum Level { Debug, Info, Warn, Error };
+
+    static Logger& instance();
+
+    void setLevel(Level newLevel) { level.store(newLevel, std::memory_order_relaxed); }
+    bool enabled(Level l) const { return l >= level.load(std::memory_order_relaxed); }
+    static bool parseLevel(const std::string& name, Level& out);
+
+    template<typename... Args>
+    void log(Level l, const char* format, const Args&... args);
+
+    // drain everything still queued and stop the background thread
+    void stop();
+    uint64_t dropped() const;
+
+    struct Record {
+        enum ArgType { Signed, Unsigned, Floating, Text };
+        static const unsigned int maxArgs = 6;
+
+        uint64_t timestamp;
+        const char* format;
+        uint8_t level;
+        uint8_t argCount;
+        uint8_t argTypes[maxArgs];
+        union Arg {
+            int64_t i;
+            uint64_t u;
+            double d;
+            struct { uint16_t offset; uint16_t length; } s;
+        } args[maxArgs];
+        // string arguments are copied here, truncated when full
+        char text[184];
+    };
+
+private:
+    Logger();
+    ~Logger();
+    Logger(const Logger&);
+    Logger& operator=(const Logger&);
+
+    class Ring;
+    Ring& localRing();
+    void writerLoop();
+    bool drain(std::string& out);
+    static void format(const Record& record, std::string& out);
+
+    // argument encoding, one overload per supported kind
+    struct Encoder {
+        Record& record;
+        unsigned int textUsed;
+        explicit Encoder(Record& r) : record(r), textUsed(0) {}
+
+        template<typename T>
+        typename std::enable_if<std::is_integral<T>::value && std::is_signed<T>::value>::type
+        put(const T& value) {
+            if (!slot(Record::Signed)) return;
+            record.args[record.argCount++].i = value;
+        }
+        template<typename T>
+        typename std::enable_if<std::is_integral<T>::value && !std::is_signed<T>::value>::type
+        put(const T& value) {
+            if (!slot(Record::Unsigned)) return;
+            record.args[record.argCount++].u = value;
+        }
+        template<typename T>
+        typename std::enable_if<std::is_floating_point<T>::value>::type
+        put(const T& value) {
+            if (!slot(Record::Floating)) return;
+            record.args[record.argCount++].d = value;
+        }
+        template<typename T>
+        typename std::enable_if<std::is_enum<T>::value>::type
+        put(const T& value) {
+            put(static_cast<int64_t>(value));
+        }
+        template<size_t N>
+        void put(const char (&value)[N]) { text(value, strnlen(value, N)); }
+        void put(const char* value) {
+            if (value == NULL) value = "(null)";
+            text(value, strlen(value));
+        }
+        void put(char* value) { put(const_cast<const char*>(value)); }
+        void put(const std::string& value) { text(value.data(), value.size()); }
+        void put(const LogBytes& value) { text(value.data, value.length); }
+
+        bool slot(Record::ArgType type) {
+            if (record.argCount >= Record::maxArgs) return false;
+            record.argTypes[record.argCount] = type;
+            return true;
+        }
+        void text(const char* value, size_t length) {
+            if (!slot(Record::Text)) return;
+            size_t room = sizeof(record.text) - textUsed;
+            if (length > room) length = room;
+            memcpy(&record.text[textUsed], value, length);
+            record.args[record.argCount].s.offset = textUsed;
+            record.args[record.argCount].s.length = length;
+            record.argCount++;
+            textUsed += length;
+        }
+        void all() {}
+        template<typename First, typename... Rest>
+        void all(const First& first, const Rest&... rest) {
+            put(first);
+            all(rest...);
+        }
+    };
+
+    Record* claim();
+    void publish();
+
+private:
+    std::atomic<int> level;
+    std::atomic<bool> running;
+
+    mutable std::mutex ringsMutex;
+    std::vector<Ring*> rings;
+
+    std::mutex wakeMutex;
+    std::condition_variable wake;
+    std::thread writer;
+    uint64_t reportedDrops;
+};
+
+template<typename... Args>
+void Logger::log(Level l, const char* format, const Args&... args) {
+    Record* record = claim();
+    if (record == NULL) return;
+
+    timespec now;
+    clock_gettime(CLOCK_REALTIME, &now);
+    record->timestamp = uint64_t(now.tv_sec) * 1000000000ull + now.tv_nsec;
+    record->format = format;
+    record->level = l;
+    record->argCount = 0;
+    Encoder encoder(*record);
+    encoder.all(args...);
+    publish();
+}
+
+#define LOG_AT(lvl, ...)                                                \
+    do {                                                                \
+        Logger& logger_ = Logger::instance();                           \
+        if (logger_.enabled(lvl)) logger_.log(lvl, __VA_ARGS__);        \
+    } while (0)
+
+#define LOG_DEBUG(...) LOG_AT(Logger::Debug, __VA_ARGS__)
+#define LOG_INFO(...)  LOG_AT(Logger::Info, __VA_ARGS__)
+#define LOG_WARN(...)  LOG_AT(Logger::Warn, __VA_ARGS__)
+#define LOG_ERROR(...) LOG_AT(Logger::Error, __VA_ARGS__)
+
+#endif
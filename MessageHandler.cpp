@@ -0,0 +1,54 @@
+#include "MessageHandler.h"
+#include "Logger.h"
+
+#include <dlfcn.h>
+
+namespace {
+
+// default behaviour: log what arrived
+class PrintHandler : public MessageHandler {
+public:
+    void handle(const Message* messages, size_t count, Responder&) {
+        for (size_t i = 0; i < count; i++) {
+            size_t length = messages[i].length;
+            if (length > 0 && messages[i].data[length - 1] == '\n') length--;
+            LOG_INFO("{}:{}", length, LogBytes(messages[i].data, length));
+        }
+    }
+};
+
+// send every message back to where it came from
+class EchoHandler : public MessageHandler {
+public:
+    void handle(const Message* messages, size_t count, Responder& responder) {
+        for (size_t i = 0; i < count; i++) {
+            responder.reply(messages[i].fd, messages[i].data, messages[i].length);
+        }
+    }
+};
+
+}
+
+MessageHandler* createMessageHandler(const std::string& name, const std::string& argument) {
+    if (name == "print") return new PrintHandler;
+    if (name == "echo") return new EchoHandler;
+
+    // handlers loaded this way stay loaded for the life of the process
+    void* library = dlopen(name.c_str(), RTLD_NOW | RTLD_LOCAL);
+    if (library == NULL) {
+        LOG_ERROR("unable to load handler {}: {}", name, dlerror());
+        return NULL;
+    }
+    CreateMessageHandler factory =
+        reinterpret_cast<CreateMessageHandler>(dlsym(library, MESSAGE_HANDLER_FACTORY));
+    if (factory == NULL) {
+        LOG_ERROR("handler {} does not export " MESSAGE_HANDLER_FACTORY, name);
+        dlclose(library);
+        return NULL;
+    }
+    MessageHandler* handler = factory(argument.c_str());
+    if (handler == NULL) {
+        LOG_ERROR("handler {} refused argument {}", name, argument);
+    }
+    return handler;
+}
@@ -0,0 +1,44 @@
+#ifndef MESSAGEHANDLER_H
+#define MESSAGEHANDLER_H
+
+#include <cstddef>
+#include <string>
+#include <vector>
+
+// Application hook for Worker.  Everything read from client connections in
+// one pass of the event loop is collected and handed to the handler as a
+// single batch of complete messages.  On a stream a message is one line,
+// including its '\n'; on a datagram flow it is one datagram.  The data
+// pointers stay valid only for the duration of the handle() call.
+struct Message {
+    int fd;
+    const char* data;
+    size_t length;
+};
+
+class Responder {
+public:
+    virtual ~Responder() {}
+    // queue data for the connection; the vector overload takes the contents
+    virtual void reply(int fd, std::vector<char>& response) = 0;
+    virtual void reply(int fd, const char* data, size_t length) = 0;
+};
+
+class MessageHandler {
+public:
+    virtual ~MessageHandler() {}
+    virtual void handle(const Message* messages, size_t count, Responder& responder) = 0;
+    // the connection is gone; drop any state kept for it
+    virtual void closed(int /*fd*/) {}
+};
+
+// Shared object handlers export this symbol:
+//   extern "C" MessageHandler* createMessageHandler(const char* argument);
+typedef MessageHandler* (*CreateMessageHandler)(const char* argument);
+#define MESSAGE_HANDLER_FACTORY "createMessageHandler"
+
+// name is one of the built-in handlers ("print", "echo") or the path of a
+// shared object; returns NULL when the handler can not be created
+MessageHandler* createMessageHandler(const std::string& name, const std::string& argument);
+
+#endif
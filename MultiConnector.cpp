@@ -1,9 +1,15 @@
 #include "MultiConnector.h"
+#include "Logger.h"
+#include "TlsHello.h"
 
 #include <iostream>
 #include <cstdio>
 #include <string>
 #include <time.h>
+#include <cstring>
+#include <cerrno>
+#include <cctype>
+#include <cstdlib>
 
 #include <boost/date_time.hpp>
 
@@ -16,14 +22,25 @@
 #include <linux/un.h>
 
 #include <vector>
+#include <algorithm>
 
 #include <sys/epoll.h>
 
 
 
-MultiConnector::MultiConnector(int argc, char** argv) {
+MultiConnector::MultiConnector(int argc, char** argv) 
+    : workerCount(0),
+      numClients(0),
+      lastScale(0)
+{
+    // harmless without --supervise, and it has to happen before the
+    // logger starts its thread
+    Supervisor::blockSignals();
 
     parseOptions(argc, argv);
+    if (supervised.empty()) {
+        Supervisor::unblockStopSignals();
+    }
 }
 
 inline void addToEpoll(int newFd, int epollFd) {
@@ -41,14 +58,16 @@ inline void removeFromEpoll(int removedFd, int epollFd) {
     event.events = EPOLLIN|EPOLLPRI|EPOLLERR;
     event.data.fd = removedFd;
     if (epoll_ctl(epollFd, EPOLL_CTL_DEL, removedFd, &event) != 0) {
-        perror("epoll_ctr remove fd failed.");
+        LOG_ERROR("epoll_ctr remove fd {} failed: {}", removedFd, strerror(errno));
     }
 }
 
 void MultiConnector::run() {
+    if (!cpus.empty() && !cpus.pin()) {
+        abort();
+    }
 
     int epollFd = epoll_create1(0);
-    epoll_event event;
     
     domainSocket = setupDomainSocket();
     if (domainSocket < 0 ) {
@@ -74,111 +93,572 @@ void MultiConnector::run() {
         addToEpoll(v6ClientSocket, epollFd);
     }
 
-    int numClients = 0;
+    connections.insert(domainSocket).type = Connection::WorkerListener;
+    connections.insert(clientSocket).type = Connection::ClientListener;
+    if (v6ClientSocket >= 0) {
+        connections.insert(v6ClientSocket).type = Connection::ClientListener;
+    }
+
+    udpSocket = -1;
+    v6UdpSocket = -1;
+    if (udp) {
+        udpSocket = setupClientUdpSocket(AF_INET);
+        if (udpSocket < 0) {
+            std::cout << "Failed to create v4 udp client socket" << std::endl;
+            abort();
+        }
+        addToEpoll(udpSocket, epollFd);
+        connections.insert(udpSocket).type = Connection::UdpListener;
+        v6UdpSocket = setupClientUdpSocket(AF_INET6);
+        if (v6UdpSocket < 0) {
+            std::cout << "Failed to create v6 udp client socket" << std::endl;
+            std::cout << "Continue with v4 only" << std::endl;
+        } else {
+            addToEpoll(v6UdpSocket, epollFd);
+            connections.insert(v6UdpSocket).type = Connection::UdpListener;
+        }
+    }
+
+    if (!supervised.empty()) {
+        if (!supervisor.start(workerPath, workerArguments, domainPath, seqpacket, scaleInterval,
+                              workerCpus.members())) {
+            std::cout << "Failed to start the worker supervisor" << std::endl;
+            abort();
+        }
+        addToEpoll(supervisor.signalFd(), epollFd);
+        addToEpoll(supervisor.timerFd(), epollFd);
+        connections.insert(supervisor.signalFd()).type = Connection::SupervisorEvent;
+        connections.insert(supervisor.timerFd()).type = Connection::SupervisorEvent;
+        // the first workers start before any client shows up
+        scalePools();
+    }
+
+    static const unsigned int maxEvents = 64;
+    epoll_event events[maxEvents];
     bool waitOnFirstConnection=true;
-    while(waitOnFirstConnection || (numClients > 0) || (workerList.size() > 0) ) {
-        int fds = epoll_wait(epollFd, &event, 1, -1);
+    while((waitOnFirstConnection || (numClients > 0) || (workerCount > 0) || supervisor.running()) &&
+          !supervisor.stopping()) {
+        int fds = epoll_wait(epollFd, events, maxEvents, -1);
         if (fds < 0) {
+            if (errno == EINTR) continue;
             perror("epoll error");
             abort();
         }
-        if (fds == 0) continue;
-
-        if (event.data.fd == clientSocket) {
-            int newFd = getNewClientConnection(event.data.fd);
-            numClients++;
-            waitOnFirstConnection=false;
-            addToEpoll(newFd, epollFd);
-        } else if (event.data.fd == v6ClientSocket) {
-            int newFd = getNewClientConnection(event.data.fd);            
-            numClients++;
-            waitOnFirstConnection=false;
-            addToEpoll(newFd, epollFd);
-        } else if (event.data.fd == domainSocket) {            
-            int newFd = getNewWorkerConnection(event.data.fd);
-            if (newFd > 0) {
+
+        for (int i = 0; i < fds; i++) {
+            int fd = events[i].data.fd;
+            Connection* conn = connections.find(fd);
+            if (conn == NULL) {
+                // closed earlier in this pass
+                continue;
+            }
+
+            switch (conn->type) {
+            case Connection::ClientListener: {
+                uint64_t affinity = 0;
+                int cpu = -1;
+                int newFd = getNewClientConnection(fd, affinity, cpu);
+                if (newFd < 0) break;
+                numClients++;
+                waitOnFirstConnection=false;
                 addToEpoll(newFd, epollFd);
-                WorkerData workData(newFd);
-                workerList.insert( std::pair<int, MultiConnector::WorkerData>(newFd, workData));
+                Connection& client = connections.insert(newFd);
+                client.type = Connection::Client;
+                client.affinity = affinity;
+                client.cpu = cpu;
+                break;
+            }
+            case Connection::UdpListener:
+                handleDatagrams(fd);
                 waitOnFirstConnection=false;
+                break;
+            case Connection::WorkerListener: {
+                int newFd = getNewWorkerConnection(fd);
+                if (newFd > 0) {
+                    addToEpoll(newFd, epollFd);
+                    Connection& worker = connections.insert(newFd);
+                    worker.type = Connection::Worker;
+                    worker.worker.readCredentials(newFd);
+                    workerCount++;
+                    waitOnFirstConnection=false;
+                }
+                break;
             }
-        } else {
-            // handle client data
-            static const unsigned int messageLength = 200; 
-            char message[messageLength];
-            int in = recv(event.data.fd, &message, messageLength-1, 0);
-            message[in]='\0';
-            if (in > 0) {
-                WorkerList::iterator iter = workerList.find(event.data.fd);
-                if (iter != workerList.end()) {
-                    std::cout <<"w: " << message << std::endl;
-                    unsigned int identifier = 0;
-                    int secure = true;
-                    sscanf(message, "%d %d", &identifier, &secure);
-                    iter->second.registration = identifier;
-                    iter->second.secure = secure;
-                    std::cout << "server " << identifier  << " secure " << secure << "registered" << std::endl;                    
-                } else {
-                    std::cout << "c: " << message << std::endl;
-                    unsigned int identifier = 0;
-                    int secure = true;
-                    sscanf(message, "%d %d", &identifier, &secure);
-                    std::cout << "register to " << identifier  << " secure " << secure << std::endl;
-                    // if we have workers let them handle it
-                    for (WorkerList::iterator iter = workerList.begin();
-                         iter != workerList.end();
-                         iter++) {
-                        // std::cout << "list: " << iter->second.registration << " match: " << identifier << std::endl;
-                        if (iter->second.registration == identifier) {
-                             if (iter->second.secure != secure) {
-                                 removeFromEpoll(event.data.fd, epollFd);
-                                 std::stringstream reply;
-                                 reply << "Failed registration: Your registration matches, but your security mode does not";
-                                 send(event.data.fd, reply.str().c_str(), reply.str().size(), 0); 
-                                 close(event.data.fd);
-                                 numClients--;
-                                 continue;
-                             }
-                            removeFromEpoll(event.data.fd, epollFd);
-                            sendFd(event.data.fd, iter->first);                        
-                            std::stringstream reply;
-                            iter->second.useCount ++;
-                            reply << "There are " << workerList.size() << " workers, your assigned to pid " << iter->second.credentials.pid;
-                            send(event.data.fd, reply.str().c_str(), reply.str().size(), 0); 
-                            close(event.data.fd);                        
-                            numClients--;
-                            continue;
-                        }
-                    }
-                    removeFromEpoll(event.data.fd, epollFd);
-                    std::stringstream reply;
-                    reply << "Failed Registration: No process registered for id=" << identifier;
-                    send(event.data.fd, reply.str().c_str(), reply.str().size(), 0); 
-                    close(event.data.fd);
+            case Connection::Worker:
+                if (!readWorkerMessage(conn->worker, fd)) {
+                    LOG_INFO("worker on socket {} disconnected", fd);
+                    removeFromEpoll(fd, epollFd);
+                    close(fd);
+                    conn->worker.load.release();
+                    leavePool(fd, conn->worker);
+                    connections.erase(fd);
+                    workerCount--;
+                }
+                break;
+            case Connection::Client:
+                if (handleClientMessage(fd, *conn, epollFd)) {
+                    connections.erase(fd);
                     numClients--;
-                } 
-            } else {
-                if (in <= 0) {
-                    std::cout << "connection error or closed" << std::endl;
-                    removeFromEpoll(event.data.fd, epollFd);
-                    close(event.data.fd);
-                    WorkerList::iterator iter = workerList.find(event.data.fd);
-                    if (iter != workerList.end()) {
-                        workerList.erase(iter);
-                    } else {
-                        numClients--;
-                    }
-                }                        
+                }
+                break;
+            case Connection::SupervisorEvent:
+                if (fd == supervisor.signalFd()) {
+                    handleChildExits();
+                } else if (supervisor.clearTick() > 0) {
+                    handleChildExits();
+                    if (!supervisor.stopping()) scalePools();
+                }
+                break;
+            default:
+                break;
             }
         }
     }
 
     close(clientSocket);
     close(domainSocket);
-    std::cout << "All connections closed. Exiting" << std::endl;
+    if (supervisor.running()) {
+        // the workers would otherwise outlive us
+        LOG_INFO("stopping supervised workers");
+        supervisor.stopAll();
+    }
+    if (udpSocket >= 0) close(udpSocket);
+    if (v6UdpSocket >= 0) close(v6UdpSocket);
+    LOG_INFO("All connections closed. Exiting");
+    LOG_INFO("rejected clients: {} by address, {} by prefix, {} at capacity, {} limiter evictions",
+             rejected.address, rejected.prefix, rejected.capacity,
+             addressLimiter.evictions() + prefixLimiter.evictions());
     return;
 }
 
+bool MultiConnector::handleClientMessage(int fd, Connection& client, int epollFd) {
+    static const unsigned int messageLength = 200; 
+    char message[messageLength];
+    int in = recv(fd, &message, messageLength-1, MSG_PEEK);
+    if (in > 0 && message[0] == 0x16 && !sniRoutes.empty()) {
+        // no preamble, the client started TLS right away
+        return handleClientHello(fd, client, epollFd);
+    }
+    if (in > 0) {
+        // consume only the registration line, data pipelined after
+        // it is left in the socket for the worker
+        char* end = static_cast<char*>(memchr(message, '\n', in));
+        int length = end ? end - message + 1 : in;
+        in = recv(fd, &message, length, 0);
+    }
+    removeFromEpoll(fd, epollFd);
+    if (in <= 0) {
+        LOG_INFO("connection error or closed on socket {}", fd);
+        close(fd);
+        return true;
+    }
+    message[in]='\0';
+    LOG_DEBUG("c: {}", message);
+    unsigned int identifier = 0;
+    int secure = true;
+    sscanf(message, "%d %d", &identifier, &secure);
+    LOG_INFO("register to {} secure {}", identifier, secure);
+
+    std::stringstream reply;
+    bool modeMismatch = false;
+    int chosen = chooseWorker(identifier, secure, client.affinity, client.cpu, modeMismatch);
+    if (chosen >= 0 && !handOff(fd, chosen)) {
+        reply << "Failed registration: the assigned worker is unavailable";
+    } else if (chosen >= 0) {
+        WorkerData& worker = connections.find(chosen)->worker;
+        reply << "There are " << workerCount << " workers, your assigned to pid " << worker.credentials.pid;
+    } else if (modeMismatch) {
+        reply << "Failed registration: Your registration matches, but your security mode does not";
+    } else {
+        reply << "Failed Registration: No process registered for id=" << identifier;
+    }
+    send(fd, reply.str().c_str(), reply.str().size(), 0); 
+    close(fd);
+    return true;
+}
+
+void MultiConnector::handleDatagrams(int listener) {
+    // a bounded batch, so the other listeners get their turn
+    static const unsigned int maxDatagrams = 64;
+    std::vector<Datagram> strays;
+    for (unsigned int i = 0; i < maxDatagrams; i++) {
+        static const unsigned int messageLength = 200;
+        char message[messageLength];
+        iovec iov[1];
+        iov[0].iov_base = message;
+        iov[0].iov_len = messageLength - 1;
+        sockaddr_storage peer;
+        char control[CMSG_SPACE(sizeof(in6_pktinfo))];
+        msghdr msg;
+        memset(&msg, 0, sizeof(msg));
+        msg.msg_name = &peer;
+        msg.msg_namelen = sizeof(peer);
+        msg.msg_iov = iov;
+        msg.msg_iovlen = 1;
+        msg.msg_control = control;
+        msg.msg_controllen = sizeof(control);
+        ssize_t in = recvmsg(listener, &msg, MSG_DONTWAIT);
+        if (in < 0) {
+            if (errno != EAGAIN && errno != EWOULDBLOCK && errno != EINTR) {
+                LOG_ERROR("recvmsg on udp socket {}: {}", listener, strerror(errno));
+            }
+            return;
+        }
+
+        // the flow socket has to answer from the address the client sent to
+        Datagram datagram;
+        datagram.peer = peer;
+        datagram.message.assign(message, in);
+        sockaddr_storage& local = datagram.local;
+        memset(&local, 0, sizeof(local));
+        local.ss_family = peer.ss_family;
+        for (cmsghdr* cmsg = CMSG_FIRSTHDR(&msg); cmsg != NULL; cmsg = CMSG_NXTHDR(&msg, cmsg)) {
+            if (cmsg->cmsg_level == IPPROTO_IP && cmsg->cmsg_type == IP_PKTINFO) {
+                in_pktinfo info;
+                memcpy(&info, CMSG_DATA(cmsg), sizeof(info));
+                reinterpret_cast<sockaddr_in&>(local).sin_addr = info.ipi_addr;
+            } else if (cmsg->cmsg_level == IPPROTO_IPV6 && cmsg->cmsg_type == IPV6_PKTINFO) {
+                in6_pktinfo info;
+                memcpy(&info, CMSG_DATA(cmsg), sizeof(info));
+                sockaddr_in6& local6 = reinterpret_cast<sockaddr_in6&>(local);
+                local6.sin6_addr = info.ipi6_addr;
+                if (IN6_IS_ADDR_LINKLOCAL(&info.ipi6_addr)) local6.sin6_scope_id = info.ipi6_ifindex;
+            }
+        }
+        int cpu = -1;
+        socklen_t cpuLength = sizeof(cpu);
+        if (getsockopt(listener, SOL_SOCKET, SO_INCOMING_CPU, &cpu, &cpuLength) != 0) {
+            cpu = -1;
+        }
+        datagram.cpu = cpu;
+        registerUdpFlow(datagram, strays);
+        // registrations a new flow socket picked up before it was connected
+        while (!strays.empty()) {
+            Datagram stray = strays.back();
+            strays.pop_back();
+            registerUdpFlow(stray, strays);
+        }
+    }
+}
+
+void MultiConnector::registerUdpFlow(const Datagram& datagram, std::vector<Datagram>& strays) {
+    uint64_t affinity = 0;
+    if (!admitClient(datagram.peer, affinity)) {
+        // dropped without an answer, like a reset TCP client
+        return;
+    }
+    unsigned int identifier = 0;
+    int secure = true;
+    if (sscanf(datagram.message.c_str(), "%u %d", &identifier, &secure) != 2) {
+        LOG_DEBUG("datagram without a registration header dropped");
+        return;
+    }
+    int flow = connectUdpFlow(datagram, strays);
+    if (flow < 0) return;
+    int cpu = datagram.cpu;
+    LOG_INFO("udp flow on socket {} cpu {} register to {}", flow, cpu, identifier);
+
+    std::stringstream reply;
+    bool modeMismatch = false;
+    int chosen = secure ? -1 : chooseWorker(identifier, false, affinity, cpu, modeMismatch);
+    if (secure) {
+        reply << "Failed registration: UDP flows are plain text only";
+    } else if (chosen >= 0 && !handOff(flow, chosen)) {
+        reply << "Failed registration: the assigned worker is unavailable";
+    } else if (chosen >= 0) {
+        WorkerData& worker = connections.find(chosen)->worker;
+        reply << "There are " << workerCount << " workers, your assigned to pid " << worker.credentials.pid;
+    } else if (modeMismatch) {
+        reply << "Failed registration: Your registration matches, but your security mode does not";
+    } else {
+        reply << "Failed Registration: No process registered for id=" << identifier;
+    }
+    send(flow, reply.str().c_str(), reply.str().size(), 0);
+    close(flow);
+}
+
+namespace {
+
+bool sameEndpoint(const sockaddr_storage& a, const sockaddr_storage& b) {
+    if (a.ss_family != b.ss_family) return false;
+    if (a.ss_family == AF_INET6) {
+        const sockaddr_in6& a6 = reinterpret_cast<const sockaddr_in6&>(a);
+        const sockaddr_in6& b6 = reinterpret_cast<const sockaddr_in6&>(b);
+        return a6.sin6_port == b6.sin6_port && IN6_ARE_ADDR_EQUAL(&a6.sin6_addr, &b6.sin6_addr);
+    }
+    const sockaddr_in& a4 = reinterpret_cast<const sockaddr_in&>(a);
+    const sockaddr_in& b4 = reinterpret_cast<const sockaddr_in&>(b);
+    return a4.sin_port == b4.sin_port && a4.sin_addr.s_addr == b4.sin_addr.s_addr;
+}
+
+}
+
+int MultiConnector::connectUdpFlow(const Datagram& datagram, std::vector<Datagram>& strays) {
+    const sockaddr_storage& peer = datagram.peer;
+    sockaddr_storage local = datagram.local;
+    socklen_t length = sizeof(sockaddr_in);
+    if (peer.ss_family == AF_INET6) {
+        length = sizeof(sockaddr_in6);
+        reinterpret_cast<sockaddr_in6&>(local).sin6_port = htons(connectPort);
+    } else {
+        reinterpret_cast<sockaddr_in&>(local).sin_port = htons(connectPort);
+    }
+    int flow = socket(peer.ss_family, SOCK_DGRAM | SOCK_CLOEXEC, IPPROTO_UDP);
+    if (flow < 0) {
+        LOG_ERROR("udp flow socket: {}", strerror(errno));
+        return -1;
+    }
+    // it shares the port with the listener; once connected the kernel
+    // prefers it for everything the peer sends
+    int on = 1;
+    if (setsockopt(flow, SOL_SOCKET, SO_REUSEADDR, &on, sizeof(on)) != 0 ||
+        setsockopt(flow, SOL_SOCKET, SO_REUSEPORT, &on, sizeof(on)) != 0 ||
+        bind(flow, reinterpret_cast<sockaddr*>(&local), length) != 0 ||
+        connect(flow, reinterpret_cast<const sockaddr*>(&peer), length) != 0) {
+        LOG_ERROR("unable to set up udp flow socket: {}", strerror(errno));
+        close(flow);
+        return -1;
+    }
+    // between bind() and connect() the kernel may have picked this socket
+    // for datagrams from other clients; they go back through registration.
+    // The peer's own data stops the scan and stays queued for the worker,
+    // which drops any foreign datagram still behind it.
+    size_t queued = strays.size();
+    for (;;) {
+        char message[200];
+        sockaddr_storage source;
+        socklen_t sourceLength = sizeof(source);
+        ssize_t in = recvfrom(flow, message, sizeof(message), MSG_DONTWAIT | MSG_PEEK,
+                              reinterpret_cast<sockaddr*>(&source), &sourceLength);
+        if (in < 0) {
+            if (errno == EINTR) continue;
+            break;
+        }
+        bool repeat = (size_t(in) == datagram.message.size() &&
+                       memcmp(message, datagram.message.data(), in) == 0);
+        if (sameEndpoint(source, peer) && !repeat) break;
+        // take it off the queue
+        if (recv(flow, message, 0, MSG_DONTWAIT) < 0) break;
+        if (sameEndpoint(source, peer)) {
+            // the peer repeating its registration before it got our answer
+            continue;
+        }
+        Datagram stray;
+        stray.peer = source;
+        stray.local = datagram.local;
+        stray.message.assign(message, in);
+        stray.cpu = datagram.cpu;
+        strays.push_back(stray);
+    }
+    if (strays.size() > queued) {
+        LOG_DEBUG("foreign datagrams queued on udp flow socket {}: {}", flow, strays.size() - queued);
+    }
+    return flow;
+}
+
+namespace {
+
+// a fatal alert lets a TLS client fail with a reason instead of a reset
+void sendTlsAlert(int fd, unsigned char description) {
+    const unsigned char alert[] = { 21, 3, 1, 0, 2, 2, description };
+    send(fd, alert, sizeof(alert), MSG_NOSIGNAL);
+}
+
+const unsigned char handshakeFailure = 40;
+const unsigned char unrecognizedName = 112;
+
+}
+
+bool MultiConnector::handleClientHello(int fd, Connection& client, int epollFd) {
+    static std::vector<unsigned char> peeked(ClientHello::maxRecord);
+    int in = recv(fd, &peeked[0], peeked.size(), MSG_PEEK);
+    ClientHello hello;
+    ClientHello::Result result = in > 0 ? hello.parse(&peeked[0], in) : ClientHello::Malformed;
+    if (result == ClientHello::Incomplete) {
+        // the peeked bytes stay readable, so wait for new data instead
+        if (!client.partialHello) {
+            epoll_event event;
+            event.events = EPOLLIN|EPOLLET;
+            event.data.fd = fd;
+            epoll_ctl(epollFd, EPOLL_CTL_MOD, fd, &event);
+            client.partialHello = true;
+        }
+        return false;
+    }
+    removeFromEpoll(fd, epollFd);
+    if (result != ClientHello::Complete) {
+        LOG_INFO("unusable TLS ClientHello on socket {}", fd);
+        close(fd);
+        return true;
+    }
+
+    for (size_t i = 0; i < hello.serverName.size(); i++) {
+        hello.serverName[i] = tolower(hello.serverName[i]);
+    }
+    // a route for the name plus one of the offered protocols wins over the name alone
+    std::map<std::string, unsigned int>::const_iterator route = sniRoutes.end();
+    for (size_t i = 0; i < hello.protocols.size() && route == sniRoutes.end(); i++) {
+        route = sniRoutes.find(hello.serverName + "/" + hello.protocols[i]);
+    }
+    if (route == sniRoutes.end()) {
+        route = sniRoutes.find(hello.serverName);
+    }
+    if (route == sniRoutes.end()) {
+        LOG_INFO("no route for server name '{}' on socket {}", hello.serverName, fd);
+        sendTlsAlert(fd, unrecognizedName);
+        close(fd);
+        return true;
+    }
+    LOG_INFO("server name '{}' routed to {}", hello.serverName, route->second);
+
+    bool modeMismatch = false;
+    int chosen = chooseWorker(route->second, true, client.affinity, client.cpu, modeMismatch);
+    if (chosen < 0) {
+        LOG_INFO("no secure worker registered for id={}", route->second);
+        sendTlsAlert(fd, handshakeFailure);
+    } else {
+        // the worker finds the ClientHello still unread in the socket
+        if (!handOff(fd, chosen)) sendTlsAlert(fd, handshakeFailure);
+    }
+    close(fd);
+    return true;
+}
+
+bool MultiConnector::parseSniMap(const std::vector<std::string>& entries) {
+    for (size_t i = 0; i < entries.size(); i++) {
+        std::string::size_type equals = entries[i].rfind('=');
+        if (equals == std::string::npos || equals == 0) return false;
+        char* end = NULL;
+        const char* number = entries[i].c_str() + equals + 1;
+        unsigned long identifier = strtoul(number, &end, 10);
+        if (*number == '\0' || *end != '\0') return false;
+        std::string name = entries[i].substr(0, equals);
+        for (size_t c = 0; c < name.size() && name[c] != '/'; c++) {
+            name[c] = tolower(name[c]);
+        }
+        sniRoutes[name] = identifier;
+    }
+    return true;
+}
+
+bool MultiConnector::readWorkerMessage(WorkerData& worker, int fd) {
+    static const unsigned int messageLength = 200; 
+    char message[messageLength];
+
+    struct iovec iov[1];
+    iov[0].iov_base = message;
+    iov[0].iov_len  = messageLength-1;
+
+    /* a registration may carry the worker's load region and eventfd */
+    static const unsigned int LOADCONTROLLEN = CMSG_SPACE(2 * sizeof(int));
+    char controlBuffer[LOADCONTROLLEN];
+    struct msghdr msg;
+    memset(&msg, 0, sizeof(msg));
+    msg.msg_iov        = iov;
+    msg.msg_iovlen     = 1;
+    msg.msg_control    = controlBuffer;
+    msg.msg_controllen = LOADCONTROLLEN;
+
+    int in = recvmsg(fd, &msg, MSG_CMSG_CLOEXEC);
+    if (in <= 0) return false;
+    message[in]='\0';
+    LOG_DEBUG("w: {}", message);
+
+    for (cmsghdr* cmptr = CMSG_FIRSTHDR(&msg); cmptr != NULL; cmptr = CMSG_NXTHDR(&msg, cmptr)) {
+        if (cmptr->cmsg_level != SOL_SOCKET || cmptr->cmsg_type != SCM_RIGHTS) continue;
+        int count = (cmptr->cmsg_len - CMSG_LEN(0)) / sizeof(int);
+        int fds[2];
+        if (count == 2 && !worker.load.valid()) {
+            memcpy(fds, CMSG_DATA(cmptr), sizeof(fds));
+            worker.load.attach(fds[0], fds[1]);
+        } else {
+            for (int i = 0; i < count; i++) {
+                int unexpected;
+                memcpy(&unexpected, CMSG_DATA(cmptr) + i * sizeof(int), sizeof(int));
+                close(unexpected);
+            }
+        }
+    }
+
+    unsigned int identifier = 0;
+    int secure = true;
+    sscanf(message, "%d %d", &identifier, &secure);
+    leavePool(fd, worker);
+    worker.registration = identifier;
+    worker.secure = secure;
+    worker.state = WorkerData::registered;
+    joinPool(fd, worker);
+    LOG_INFO("server {} secure {} registered, load sharing {}", identifier, secure,
+             worker.load.valid() ? "on" : "off");
+    return true;
+}
+
+MultiConnector::Pool& MultiConnector::pool(const Supervisor::PoolKey& key) {
+    Pools::iterator iter = pools.find(key);
+    if (iter == pools.end()) {
+        iter = pools.insert(std::make_pair(key, Pool(virtualNodes))).first;
+    }
+    return iter->second;
+}
+
+void MultiConnector::joinPool(int fd, const WorkerData& worker) {
+    Pool& joined = pool(std::make_pair(worker.registration, worker.secure));
+    joined.members.push_back(fd);
+    if (sticky) joined.ring.add(fd, worker.credentials.pid);
+}
+
+bool MultiConnector::handOff(int fd, int workerFd) {
+    WorkerData& worker = connections.find(workerFd)->worker;
+    if (sendFd(fd, workerFd) != 0) {
+        // the worker is gone; its hang-up takes it out of the pool
+        LOG_WARN("hand-off of socket {} to worker pid {} failed: {}", fd, worker.credentials.pid, strerror(errno));
+        return false;
+    }
+    worker.useCount ++;
+    pool(std::make_pair(worker.registration, worker.secure)).assigned++;
+    return true;
+}
+
+void MultiConnector::leavePool(int fd, const WorkerData& worker) {
+    if (worker.state != WorkerData::registered) return;
+    Pools::iterator pool = pools.find(std::make_pair(worker.registration, worker.secure));
+    if (pool == pools.end()) return;
+    std::vector<int>& members = pool->second.members;
+    members.erase(std::remove(members.begin(), members.end(), fd), members.end());
+    if (sticky) pool->second.ring.remove(fd);
+}
+
+int MultiConnector::chooseWorker(unsigned int identifier, bool secure, uint64_t affinity, int cpu, bool& modeMismatch) {
+    Pools::iterator pool = pools.find(std::make_pair(identifier, secure));
+    if (pool == pools.end() || pool->second.members.empty()) {
+        Pools::iterator other = pools.find(std::make_pair(identifier, !secure));
+        modeMismatch = (other != pools.end() && !other->second.members.empty());
+        return -1;
+    }
+
+    if (sticky) {
+        // a returning client lands on the same worker while the pool is stable
+        return pool->second.ring.lookup(affinity);
+    }
+
+    // a worker on the cpu, or NUMA node, that took the client's packets
+    // wins unless it is busier by more than the locality weight
+    int node = CpuSet::nodeOf(cpu);
+    int best = -1;
+    unsigned long long bestCost = 0;
+    const std::vector<int>& members = pool->second.members;
+    for (size_t i = 0; i < members.size(); i++) {
+        const WorkerData& worker = connections.find(members[i])->worker;
+        unsigned long long cost = worker.cost();
+        if (cpu >= 0) cost += worker.distance(cpu, node, localityWeight);
+        if (best < 0 || cost < bestCost) {
+            best = members[i];
+            bestCost = cost;
+        }
+    }
+    return best;
+}
+
 int MultiConnector::getNewWorkerConnection(int domainSocket) {
     struct sockaddr_storage clientaddr;  
     int  clientaddrlen = sizeof(clientaddr);
@@ -191,17 +671,15 @@ int MultiConnector::getNewWorkerConnection(int domainSocket) {
     sockaddr_in6& ipv6Sock = *reinterpret_cast<sockaddr_in6*>(&clientaddr);
     char ipAddrStr[INET6_ADDRSTRLEN];
     if (ipv4Sock.sin_family == PF_LOCAL) {
-        std::cout << "New local connection" << std::endl;
+        LOG_INFO("New local connection on socket {}", newFd);
     }
     if (ipv4Sock.sin_family == AF_INET) {
         inet_ntop(ipv4Sock.sin_family, &(ipv4Sock.sin_addr), ipAddrStr, sizeof(ipAddrStr)); 
-        std::cout << "New ipv4 connection from " << ipAddrStr 
-                  <<  " on socket " << newFd << std::endl;
+        LOG_INFO("New ipv4 connection from {} on socket {}", ipAddrStr, newFd);
     } 
     if (ipv6Sock.sin6_family == AF_INET6) {
         inet_ntop(ipv6Sock.sin6_family, &(ipv6Sock.sin6_addr), ipAddrStr, sizeof(ipAddrStr)); 
-        std::cout << "New ipv6 connection from " << ipAddrStr 
-                  <<  " on socket " << newFd << std::endl;
+        LOG_INFO("New ipv6 connection from {} on socket {}", ipAddrStr, newFd);
     } 
     return newFd;
 }
@@ -209,34 +687,209 @@ int MultiConnector::getNewWorkerConnection(int domainSocket) {
 
 
 
-int MultiConnector::getNewClientConnection(int clientSocket) {
+int MultiConnector::getNewClientConnection(int clientSocket, uint64_t& affinity, int& cpu) {
     struct sockaddr_storage clientaddr;  
-    int  clientaddrlen = sizeof(clientaddr);
-    int newFd = accept(clientSocket,
-                       (struct sockaddr *) &clientaddr,
-                       (socklen_t *)&clientaddrlen);
-    if (newFd == -1) perror("Accept");
-    
+    socklen_t clientaddrlen = sizeof(clientaddr);
+    int newFd = accept4(clientSocket,
+                        (struct sockaddr *) &clientaddr,
+                        &clientaddrlen,
+                        SOCK_CLOEXEC);
+    if (newFd == -1) {
+        LOG_ERROR("Accept: {}", strerror(errno));
+        return newFd;
+    }
+
+    if (!admitClient(clientaddr, affinity)) {
+        // reset instead of a normal close, a flood should not leave
+        // TIME_WAIT sockets behind on our side
+        linger reset = { 1, 0 };
+        setsockopt(newFd, SOL_SOCKET, SO_LINGER, &reset, sizeof(reset));
+        close(newFd);
+        return -1;
+    }
+
+    // the cpu that ran the softirq for this flow
+    socklen_t cpuLength = sizeof(cpu);
+    if (getsockopt(newFd, SOL_SOCKET, SO_INCOMING_CPU, &cpu, &cpuLength) != 0) {
+        cpu = -1;
+    }
+
     sockaddr_in& ipv4Sock = *reinterpret_cast<sockaddr_in*>(&clientaddr);
     sockaddr_in6& ipv6Sock = *reinterpret_cast<sockaddr_in6*>(&clientaddr);
     char ipAddrStr[INET6_ADDRSTRLEN];
     if (ipv4Sock.sin_family == PF_LOCAL) {
-        std::cout << "New local connection" << std::endl;
+        LOG_INFO("New local connection on socket {}", newFd);
     }
     if (ipv4Sock.sin_family == AF_INET) {
         inet_ntop(ipv4Sock.sin_family, &(ipv4Sock.sin_addr), ipAddrStr, sizeof(ipAddrStr)); 
-        std::cout << "New ipv4 connection from " << ipAddrStr 
-                  <<  " on socket " << newFd << std::endl;
+        LOG_INFO("New ipv4 connection from {} on socket {} cpu {}", ipAddrStr, newFd, cpu);
     } 
     if (ipv6Sock.sin6_family == AF_INET6) {
         inet_ntop(ipv6Sock.sin6_family, &(ipv6Sock.sin6_addr), ipAddrStr, sizeof(ipAddrStr)); 
-        std::cout << "New ipv6 connection from " << ipAddrStr 
-                  <<  " on socket " << newFd << std::endl;
+        LOG_INFO("New ipv6 connection from {} on socket {} cpu {}", ipAddrStr, newFd, cpu);
     } 
  
     return newFd;
 }
 
+bool MultiConnector::admitClient(const sockaddr_storage& address, uint64_t& affinity) {
+    const unsigned char* bytes = NULL;
+    size_t length = 0;
+    size_t prefixLength = 0;
+    if (address.ss_family == AF_INET) {
+        const sockaddr_in& ipv4Sock = reinterpret_cast<const sockaddr_in&>(address);
+        bytes = reinterpret_cast<const unsigned char*>(&ipv4Sock.sin_addr);
+        length = sizeof(ipv4Sock.sin_addr);
+        prefixLength = 3;
+    } else if (address.ss_family == AF_INET6) {
+        const sockaddr_in6& ipv6Sock = reinterpret_cast<const sockaddr_in6&>(address);
+        bytes = reinterpret_cast<const unsigned char*>(&ipv6Sock.sin6_addr);
+        length = sizeof(ipv6Sock.sin6_addr);
+        prefixLength = 8;
+    }
+    if (bytes != NULL) {
+        affinity = HashRing::hash(bytes, length);
+    }
+
+    if (maxClients > 0 && numClients >= maxClients) {
+        rejected.capacity++;
+        LOG_DEBUG("rejecting client, {} registrations pending", numClients);
+        return false;
+    }
+    if (bytes == NULL) return true;
+
+    timespec now;
+    clock_gettime(CLOCK_MONOTONIC_COARSE, &now);
+    uint64_t nanos = now.tv_sec * 1000000000ull + now.tv_nsec;
+
+    // the prefix hash is salted by its length so it never meets an address key
+    unsigned char prefix[9];
+    memcpy(prefix, bytes, prefixLength);
+    prefix[prefixLength] = prefixLength;
+    if (!prefixLimiter.allow(HashRing::hash(prefix, prefixLength + 1), nanos)) {
+        rejected.prefix++;
+        LOG_DEBUG("rejecting client, prefix over rate ({} so far)", rejected.prefix);
+        return false;
+    }
+    if (!addressLimiter.allow(affinity, nanos)) {
+        rejected.address++;
+        LOG_DEBUG("rejecting client, address over rate ({} so far)", rejected.address);
+        return false;
+    }
+    return true;
+}
+
+
+bool MultiConnector::parseSupervised(const std::vector<std::string>& entries) {
+    for (size_t i = 0; i < entries.size(); i++) {
+        // id or id:secure, nothing after it
+        const char* entry = entries[i].c_str();
+        char* end = NULL;
+        unsigned long identifier = strtoul(entry, &end, 10);
+        if (!isdigit(*entry) || (*end != '\0' && *end != ':')) return false;
+        unsigned long secure = 0;
+        if (*end == ':') {
+            const char* mode = end + 1;
+            secure = strtoul(mode, &end, 10);
+            if (!isdigit(*mode) || *end != '\0') return false;
+        }
+        supervised.push_back(std::make_pair(static_cast<unsigned int>(identifier), secure != 0));
+    }
+    return true;
+}
+
+void MultiConnector::handleChildExits() {
+    std::vector<Supervisor::Exit> exits;
+    supervisor.reap(exits);
+    for (size_t i = 0; i < exits.size(); i++) {
+        // a worker that crashes on start is left to the next tick,
+        // otherwise a broken binary would fork in a tight loop
+        if (!exits[i].expected && !exits[i].early && !supervisor.stopping()) {
+            supervisor.spawn(exits[i].pool);
+        }
+    }
+}
+
+void MultiConnector::scalePools() {
+    // scale down only after this many ticks in a row asked for fewer workers
+    static const unsigned int scaleDownTicks = 5;
+
+    timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    uint64_t nowMillis = now.tv_sec * 1000ull + now.tv_nsec / 1000000;
+    double seconds = lastScale ? (nowMillis - lastScale) / 1000.0 : 0;
+    lastScale = nowMillis;
+
+    for (size_t i = 0; i < supervised.size(); i++) {
+        const Supervisor::PoolKey& key = supervised[i];
+        Pool& scaled = pool(key);
+
+        double rate = seconds > 0 ? (scaled.assigned - scaled.lastAssigned) / seconds : 0;
+        scaled.lastAssigned = scaled.assigned;
+        // a rising rate is extrapolated one tick ahead so the capacity is
+        // there when the burst arrives, not a tick after it
+        double predicted = rate > scaled.lastRate ? 2 * rate - scaled.lastRate : rate;
+        scaled.lastRate = rate;
+
+        // hand-offs sent that the workers have not picked up yet
+        uint64_t outstanding = 0;
+        for (size_t m = 0; m < scaled.members.size(); m++) {
+            const WorkerData& worker = connections.find(scaled.members[m])->worker;
+            SharedLoad::Snapshot snapshot;
+            if (worker.load.valid() && worker.load.read(snapshot) && worker.useCount > snapshot.accepted) {
+                outstanding += worker.useCount - snapshot.accepted;
+            }
+        }
+
+        unsigned int needed = (unsigned int)(predicted / assignmentsPerWorker + 0.999);
+        if (outstanding > scaled.members.size() && needed <= scaled.members.size()) {
+            needed = scaled.members.size() + 1;
+        }
+        unsigned int desired = needed + spareWorkers;
+        if (desired < minWorkers) desired = minWorkers;
+        if (desired > maxWorkers) desired = maxWorkers;
+
+        unsigned int current = supervisor.count(key);
+        LOG_DEBUG("pool {} secure {}: {} workers, {} wanted, {}/s assigned, {} outstanding",
+                  key.first, key.second, current, desired, rate, outstanding);
+        if (desired > current) {
+            scaled.quietTicks = 0;
+            for (unsigned int n = current; n < desired; n++) {
+                supervisor.spawn(key);
+            }
+        } else if (desired < current && ++scaled.quietTicks >= scaleDownTicks) {
+            scaled.quietTicks = 0;
+            retireOne(key);
+        } else if (desired >= current) {
+            scaled.quietTicks = 0;
+        }
+    }
+}
+
+void MultiConnector::retireOne(const Supervisor::PoolKey& key) {
+    Pool& scaled = pool(key);
+    int chosen = -1;
+    uint32_t fewest = 0;
+    for (size_t m = 0; m < scaled.members.size(); m++) {
+        const WorkerData& worker = connections.find(scaled.members[m])->worker;
+        SharedLoad::Snapshot snapshot;
+        if (!worker.load.valid() || !supervisor.supervises(worker.credentials.pid)) continue;
+        if (!worker.load.read(snapshot)) continue;
+        if (chosen < 0 || snapshot.activeConnections < fewest) {
+            chosen = scaled.members[m];
+            fewest = snapshot.activeConnections;
+        }
+    }
+    if (chosen < 0) return;
+
+    WorkerData& worker = connections.find(chosen)->worker;
+    if (!worker.load.postCommand(SharedLoad::Retire)) return;
+    LOG_INFO("retiring worker pid {} of pool {} secure {}", worker.credentials.pid, key.first, key.second);
+    supervisor.retire(worker.credentials.pid);
+    // no new clients while it drains its current ones
+    leavePool(chosen, worker);
+    worker.state = WorkerData::connected;
+}
 
 int MultiConnector::sendFd(int fd_to_send, int fd_of_worker)
 {
@@ -244,8 +897,11 @@ int MultiConnector::sendFd(int fd_to_send, int fd_of_worker)
     struct msghdr   msg;
     char            buf[2]; /* send_fd()/recv_fd() 2-byte protocol */
     
+    /* a SOCK_SEQPACKET message is delimited already, send only the status */
+    unsigned int length = seqpacket ? 1 : 2;
+    char* status = seqpacket ? &buf[0] : &buf[1];
     iov[0].iov_base = buf;
-    iov[0].iov_len  = 2;
+    iov[0].iov_len  = length;
     msg.msg_iov     = iov;
     msg.msg_iovlen  = 1;
     msg.msg_name    = NULL;
@@ -253,9 +909,9 @@ int MultiConnector::sendFd(int fd_to_send, int fd_of_worker)
     if (fd_to_send < 0) {
         msg.msg_control    = NULL;
         msg.msg_controllen = 0;
-        buf[1] = -fd_to_send;   /* nonzero status means error */
-        if (buf[1] == 0)
-        buf[1] = 1; /* -256, etc. would screw up protocol */
+        *status = -fd_to_send;   /* nonzero status means error */
+        if (*status == 0)
+        *status = 1; /* -256, etc. would screw up protocol */
     } else {
         /* size of control buffer to send/recv one file descriptor */
         static const unsigned int CONTROLLEN = CMSG_LEN(sizeof(int));
@@ -267,10 +923,11 @@ int MultiConnector::sendFd(int fd_to_send, int fd_of_worker)
         msg.msg_control    = cmptr;
         msg.msg_controllen = CONTROLLEN;
         *(int *)CMSG_DATA(cmptr) = fd_to_send;     /* the fd to pass */
-        buf[1] = 0;          /* zero status means OK */
+        *status = 0;          /* zero status means OK */
     }
-    buf[0] = 0;              /* null byte flag to recv_fd() */
-    if (sendmsg(fd_of_worker, &msg, 0) != 2)
+    if (!seqpacket)
+        buf[0] = 0;              /* null byte flag to recv_fd() */
+    if (sendmsg(fd_of_worker, &msg, MSG_NOSIGNAL) != (ssize_t)length)
         return(-1);
     return(0);
 }
@@ -283,12 +940,55 @@ void MultiConnector::parseOptions(int argc, char** argv) {
     // default values
     domainPath = "/tmp/shared.fd";
     connectPort = 6789;
+    seqpacket = false;
+    udp = false;
+    sticky = false;
+    virtualNodes = 100;
+    maxClients = 0;
+    addressRate = 0;
+    addressBurst = 10;
+    prefixRate = 0;
+    prefixBurst = 100;
+    std::string logLevel = "info";
+    std::vector<std::string> sniMap;
+    std::vector<std::string> supervise;
+    workerPath = "./worker";
+    minWorkers = 1;
+    maxWorkers = 8;
+    spareWorkers = 1;
+    scaleInterval = 1000;
+    assignmentsPerWorker = 100;
+    localityWeight = 2;
+    std::string cpuList;
+    std::string workerCpuList;
     try {
         boost::program_options::options_description desc("Options");
         desc.add_options()
         ("help", "print help messages")
         ("port,p", boost::program_options::value<unsigned int>(&connectPort), "port to connect to")
         ("domainPath,d", boost::program_options::value<std::string>(&domainPath), "file to be used as name for domain socket")
+        ("seqpacket", boost::program_options::bool_switch(&seqpacket), "use SOCK_SEQPACKET for the worker domain socket")
+        ("udp", boost::program_options::bool_switch(&udp), "also take UDP flows on the client port, registered by their first datagram")
+        ("sticky", boost::program_options::bool_switch(&sticky), "route a client address to the same worker of a pool")
+        ("virtualNodes", boost::program_options::value<unsigned int>(&virtualNodes), "hash ring points per worker for --sticky")
+        ("maxClients", boost::program_options::value<unsigned int>(&maxClients), "pending client registrations before new ones are refused, 0 for no limit")
+        ("rateLimit", boost::program_options::value<double>(&addressRate), "client connections per second from one address, 0 for no limit")
+        ("rateBurst", boost::program_options::value<double>(&addressBurst), "connections one address may open at once")
+        ("prefixRateLimit", boost::program_options::value<double>(&prefixRate), "client connections per second from one /24 or /64, 0 for no limit")
+        ("prefixRateBurst", boost::program_options::value<double>(&prefixBurst), "connections one prefix may open at once")
+        ("sniMap", boost::program_options::value<std::vector<std::string> >(&sniMap)->composing(), "name=id or name/alpn=id, route direct TLS clients by server name")
+        ("supervise", boost::program_options::value<std::vector<std::string> >(&supervise)->composing(), "id or id:secure, start and scale the workers of this pool")
+        ("workerPath", boost::program_options::value<std::string>(&workerPath), "worker binary started by --supervise")
+        ("workerArg", boost::program_options::value<std::vector<std::string> >(&workerArguments)->composing(), "extra argument for supervised workers, e.g. --workerArg=--handler=echo")
+        ("minWorkers", boost::program_options::value<unsigned int>(&minWorkers), "fewest workers per supervised pool")
+        ("maxWorkers", boost::program_options::value<unsigned int>(&maxWorkers), "most workers per supervised pool")
+        ("spareWorkers", boost::program_options::value<unsigned int>(&spareWorkers), "idle workers kept ready above the current demand")
+        ("scaleInterval", boost::program_options::value<unsigned int>(&scaleInterval), "ms between scaling decisions")
+        ("assignmentsPerWorker", boost::program_options::value<double>(&assignmentsPerWorker), "client assignments per second one worker is sized for")
+        ("cpus", boost::program_options::value<std::string>(&cpuList), "pin the connector loop to these cpus, e.g. 0-3,8")
+        ("workerCpus", boost::program_options::value<std::string>(&workerCpuList), "pin each supervised worker to one of these cpus in turn")
+        ("localityWeight", boost::program_options::value<unsigned int>(&localityWeight), "queued connections a worker on the client's cpu may carry over the least loaded one")
+        ("logLevel", boost::program_options::value<std::string>(&logLevel), "debug, info, warn or error")
         ;
         try {
             store(parse_command_line(argc, argv, desc), options_map);
@@ -308,6 +1008,31 @@ void MultiConnector::parseOptions(int argc, char** argv) {
         throw;
     }    
 
+    Logger::Level level;
+    if (!Logger::parseLevel(logLevel, level)) {
+        std::cout << "unknown log level " << logLevel << std::endl;
+        exit(4);
+    }
+    Logger::instance().setLevel(level);
+    if (!parseSupervised(supervise)) {
+        std::cout << "--supervise expects id or id:secure" << std::endl;
+        exit(4);
+    }
+    if (minWorkers > maxWorkers || assignmentsPerWorker <= 0) {
+        std::cout << "--minWorkers exceeds --maxWorkers or --assignmentsPerWorker is not positive" << std::endl;
+        exit(4);
+    }
+    if ((!cpuList.empty() && !cpus.parse(cpuList)) ||
+        (!workerCpuList.empty() && !workerCpus.parse(workerCpuList))) {
+        std::cout << "unusable cpu list" << std::endl;
+        exit(4);
+    }
+    if (!parseSniMap(sniMap)) {
+        std::cout << "--sniMap expects name=id" << std::endl;
+        exit(4);
+    }
+    addressLimiter.configure(addressRate, addressBurst);
+    prefixLimiter.configure(prefixRate, prefixBurst);
     return;
 }
 
@@ -316,7 +1041,7 @@ int MultiConnector::setupDomainSocket() {
     domainAddr.sun_family = AF_UNIX;
     strcpy(domainAddr.sun_path, domainPath.c_str());
     unlink (domainAddr.sun_path);
-    int dSocket = socket(PF_UNIX, SOCK_STREAM, 0);
+    int dSocket = socket(PF_UNIX, seqpacket ? SOCK_SEQPACKET : SOCK_STREAM, 0);
     if (dSocket < 0) {
         perror("unable to create domain socket");
         return dSocket;
@@ -394,18 +1119,89 @@ int MultiConnector::setupClientV4Socket() {
     return cSocket;
 }
 
-MultiConnector::WorkerData::WorkerData(int fd) 
+int MultiConnector::setupClientUdpSocket(int family) {
+    int uSocket = socket(family, SOCK_DGRAM | SOCK_NONBLOCK | SOCK_CLOEXEC, IPPROTO_UDP);
+    if (uSocket == -1) {
+        perror("Socket");
+        return uSocket;
+    }
+
+    // flow sockets bind the same port, and need the address each
+    // registration was sent to
+    int on = 1;
+    int rc = setsockopt(uSocket, SOL_SOCKET, SO_REUSEADDR, &on, sizeof(on));
+    if (rc == 0) rc = setsockopt(uSocket, SOL_SOCKET, SO_REUSEPORT, &on, sizeof(on));
+    if (rc == 0 && family == AF_INET6) {
+        rc = setsockopt(uSocket, IPPROTO_IPV6, IPV6_V6ONLY, &on, sizeof(on));
+        if (rc == 0) rc = setsockopt(uSocket, IPPROTO_IPV6, IPV6_RECVPKTINFO, &on, sizeof(on));
+    } else if (rc == 0) {
+        rc = setsockopt(uSocket, IPPROTO_IP, IP_PKTINFO, &on, sizeof(on));
+    }
+    if (rc != 0) {
+        perror("unable to set udp client socket options");
+        close(uSocket);
+        return -1;
+    }
+
+    sockaddr_storage clientConnectAddr;
+    bzero(&clientConnectAddr, sizeof(clientConnectAddr));
+    socklen_t length = sizeof(sockaddr_in);
+    if (family == AF_INET6) {
+        sockaddr_in6& ipv6Addr = reinterpret_cast<sockaddr_in6&>(clientConnectAddr);
+        ipv6Addr.sin6_family = AF_INET6;
+        ipv6Addr.sin6_port = htons(connectPort);
+        ipv6Addr.sin6_addr = in6addr_any;
+        length = sizeof(sockaddr_in6);
+    } else {
+        sockaddr_in& ipv4Addr = reinterpret_cast<sockaddr_in&>(clientConnectAddr);
+        ipv4Addr.sin_family = AF_INET;
+        ipv4Addr.sin_addr.s_addr = htonl(INADDR_ANY);
+        ipv4Addr.sin_port = htons(connectPort);
+    }
+    if (-1 == bind(uSocket, reinterpret_cast<sockaddr*>(&clientConnectAddr), length)) {
+        perror("Unable to bind udp client socket");
+        close(uSocket);
+        return -1;
+    }
+    return uSocket;
+}
+
+unsigned long long MultiConnector::WorkerData::cost() const {
+    SharedLoad::Snapshot snapshot;
+    if (!load.read(snapshot)) {
+        return (unsigned long long)useCount * 1000;
+    }
+    // hand-offs sent but not yet picked up count as queued work
+    unsigned long long outstanding = 0;
+    if (useCount > snapshot.accepted) outstanding = useCount - snapshot.accepted;
+    unsigned long long queued = snapshot.activeConnections + snapshot.queueDepth + outstanding;
+    return queued * 1000 + snapshot.busyPermille;
+}
+
+unsigned long long MultiConnector::WorkerData::distance(int cpu, int node, unsigned int weight) const {
+    SharedLoad::Snapshot snapshot;
+    if (!load.read(snapshot) || snapshot.cpu < 0) return weight * 1000ull;
+    if (snapshot.cpu == cpu) return 0;
+    if (node >= 0 && snapshot.node == node) return weight * 500ull;
+    return weight * 1000ull;
+}
+
+MultiConnector::WorkerData::WorkerData() 
     : useCount(0),
       secure(false),
       registration(0),
       state(connected)
 {
+    memset(&credentials, 0, sizeof(credentials));
+}
+
+void MultiConnector::WorkerData::readCredentials(int fd) {
     socklen_t ucred_length = sizeof(credentials);
     if (getsockopt(fd,
                    SOL_SOCKET,
                    SO_PEERCRED,
                    &credentials,
                    &ucred_length)) {
-        std::cout << "unable to get credentials for fd " << fd << std::endl;
+        LOG_WARN("unable to get credentials for fd {}", fd);
     }
 }
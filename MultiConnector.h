@@ -1,9 +1,17 @@
 #ifndef MULTICONNECTOR_H
 #define MULTICONNECTOR_H
 
+#include "SharedLoad.h"
+#include "HashRing.h"
+#include "FdTable.h"
+#include "RateLimiter.h"
+#include "Supervisor.h"
+#include "CpuSet.h"
+
 #include <boost/program_options.hpp>
 #include <string>
 #include <map>
+#include <vector>
 #include <sys/socket.h>
 
 class MultiConnector {
@@ -19,34 +27,134 @@ private:
     int  setupDomainSocket();
     int  setupClientV4Socket();
     int  setupClientV6Socket();
-    int  getNewClientConnection(int clientSocket);
+    int  setupClientUdpSocket(int family);
+    int  getNewClientConnection(int clientSocket, uint64_t& affinity, int& cpu);
+    bool admitClient(const sockaddr_storage& address, uint64_t& affinity);
     int  getNewWorkerConnection(int domainSocket);
+
+    // --udp: a flow registers with its first datagram and gets a
+    // connected socket of its own, which goes to the worker
+    struct Datagram {
+        sockaddr_storage peer;
+        sockaddr_storage local;     // the address it was sent to
+        std::string message;
+        int cpu;
+    };
+    void handleDatagrams(int listener);
+    void registerUdpFlow(const Datagram& datagram, std::vector<Datagram>& strays);
+    int  connectUdpFlow(const Datagram& datagram, std::vector<Datagram>& strays);
+
+    struct WorkerData;
+    bool readWorkerMessage(WorkerData& worker, int fd);
+    struct Connection;
+    bool handleClientMessage(int fd, Connection& client, int epollFd);
+    bool handleClientHello(int fd, Connection& client, int epollFd);
+    bool parseSniMap(const std::vector<std::string>& entries);
+    int  chooseWorker(unsigned int identifier, bool secure, uint64_t affinity, int cpu, bool& modeMismatch);
+    void joinPool(int fd, const WorkerData& worker);
+    void leavePool(int fd, const WorkerData& worker);
+    bool handOff(int fd, int workerFd);
+
+    // --supervise
+    bool parseSupervised(const std::vector<std::string>& entries);
+    void handleChildExits();
+    void scalePools();
+    void retireOne(const Supervisor::PoolKey& key);
 private:
     // variables
     boost::program_options::variables_map options_map;
 
     // options variables
-    unsigned int maxClients;    
+    unsigned int maxClients;    // pending registrations, 0 for no limit
+    double addressRate;
+    double addressBurst;
+    double prefixRate;
+    double prefixBurst;
     std::string domainPath;
+    bool seqpacket;
+    bool udp;
+    bool sticky;
+    unsigned int virtualNodes;
     unsigned int connectPort;
     std::string clientListenAddress;
+    // direct TLS clients: server name, or "name/alpn", to identifier
+    std::map<std::string, unsigned int> sniRoutes;
+    // pools whose workers the connector starts itself
+    std::vector<Supervisor::PoolKey> supervised;
+    std::string workerPath;
+    std::vector<std::string> workerArguments;
+    unsigned int minWorkers;
+    unsigned int maxWorkers;
+    unsigned int spareWorkers;
+    unsigned int scaleInterval;         // ms
+    double assignmentsPerWorker;        // per second one worker is sized for
+    CpuSet cpus;
+    CpuSet workerCpus;                  // supervised workers get one each, round robin
+    unsigned int localityWeight;        // queued connections locality is worth
 
     // internal variables
     int domainSocket;
     int clientSocket;
     int v6ClientSocket;
+    int udpSocket;
+    int v6UdpSocket;
 
     struct WorkerData {
-        WorkerData(int fd);
-        int useCount;
+        WorkerData();
+        void readCredentials(int fd);
+        // lower is better; uses the worker's shared load report when present
+        unsigned long long cost() const;
+        // extra cost for serving a client whose packets arrive on cpu
+        unsigned long long distance(int cpu, int node, unsigned int weight) const;
+        unsigned int useCount;
         ucred credentials;
         bool secure;
         unsigned registration;
         enum {connected, registered } state;
+        SharedLoad load;
+    };
+
+    // one record per descriptor in the epoll set
+    struct Connection {
+        Connection() : type(Unused), affinity(0), cpu(-1), partialHello(false) {}
+        enum { Unused, ClientListener, UdpListener, WorkerListener, Client, Worker, SupervisorEvent } type;
+        uint64_t affinity;      // clients: hash of the peer address
+        int cpu;                // clients: SO_INCOMING_CPU, -1 unknown
+        bool partialHello;      // clients: edge triggered until the ClientHello is in
+        WorkerData worker;      // workers only
+    };
+    FdTable<Connection> connections;
+    unsigned int workerCount;
+    unsigned int numClients;
+
+    // connection rate per source address and per /24 (v4) or /64 (v6) prefix
+    RateLimiter addressLimiter;
+    RateLimiter prefixLimiter;
+    struct Rejections {
+        Rejections() : address(0), prefix(0), capacity(0) {}
+        uint64_t address;
+        uint64_t prefix;
+        uint64_t capacity;
+    } rejected;
+
+    // registered workers by (identifier, secure); the ring is used by --sticky
+    struct Pool {
+        explicit Pool(unsigned int virtualNodes)
+            : ring(virtualNodes), assigned(0), lastAssigned(0), lastRate(0), quietTicks(0) {}
+        std::vector<int> members;
+        HashRing ring;
+        // scaling state for supervised pools
+        uint64_t assigned;
+        uint64_t lastAssigned;
+        double lastRate;
+        unsigned int quietTicks;
     };
+    typedef std::map<std::pair<unsigned int, bool>, Pool> Pools;
+    Pools pools;
+    Pool& pool(const Supervisor::PoolKey& key);
 
-    typedef std::map<int, WorkerData> WorkerList;
-    WorkerList workerList;
+    Supervisor supervisor;
+    uint64_t lastScale;         // ms
 
 };
 
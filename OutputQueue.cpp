@@ -0,0 +1,254 @@
+#include "OutputQueue.h"
+#include "Logger.h"
+
+#include <cerrno>
+#include <cstring>
+#include <climits>
+
+#include <sys/socket.h>
+#include <sys/uio.h>
+#include <netinet/in.h>
+#include <linux/errqueue.h>
+
+#include <openssl/ssl.h>
+
+#ifndef MSG_ZEROCOPY
+#define MSG_ZEROCOPY 0x4000000
+#endif
+
+#ifndef SO_EE_ORIGIN_ZEROCOPY
+#define SO_EE_ORIGIN_ZEROCOPY 5
+#endif
+
+OutputQueue::OutputQueue()
+    : frontOffset(0),
+      queuedBytes(0),
+      writeBlocked(false),
+      zerocopy(false),
+      zerocopyThreshold(0),
+      nextSequence(0),
+      frontLastSequence(0),
+      frontZerocopied(false)
+{
+}
+
+void OutputQueue::push(std::vector<char>& buffer) {
+    if (buffer.empty()) return;
+    queuedBytes += buffer.size();
+    buffers.push_back(std::vector<char>());
+    buffers.back().swap(buffer);
+}
+
+void OutputQueue::push(const char* data, size_t length) {
+    if (length == 0) return;
+    queuedBytes += length;
+    buffers.push_back(std::vector<char>(data, data + length));
+}
+
+void OutputQueue::enableZerocopy(size_t threshold) {
+    zerocopy = true;
+    zerocopyThreshold = threshold;
+}
+
+void OutputQueue::consume(size_t bytes) {
+    queuedBytes -= bytes;
+    while (bytes > 0) {
+        std::vector<char>& front = buffers.front();
+        size_t left = front.size() - frontOffset;
+        if (bytes < left) {
+            frontOffset += bytes;
+            return;
+        }
+        bytes -= left;
+        if (frontZerocopied) {
+            // the kernel may still read from it; park it until completion
+            inFlight.push_back(InFlight());
+            inFlight.back().lastSequence = frontLastSequence;
+            inFlight.back().buffer.swap(front);
+            frontZerocopied = false;
+        }
+        buffers.pop_front();
+        frontOffset = 0;
+    }
+}
+
+OutputQueue::Result OutputQueue::sendZerocopy(int fd) {
+    std::vector<char>& front = buffers.front();
+    iovec iov;
+    iov.iov_base = &front[frontOffset];
+    iov.iov_len = front.size() - frontOffset;
+
+    msghdr msg;
+    memset(&msg, 0, sizeof(msg));
+    msg.msg_iov = &iov;
+    msg.msg_iovlen = 1;
+    ssize_t sent = sendmsg(fd, &msg, MSG_ZEROCOPY | MSG_NOSIGNAL);
+    if (sent < 0) {
+        if (errno == EAGAIN || errno == EWOULDBLOCK) return Blocked;
+        if (errno == ENOBUFS) {
+            // out of optmem for notifications: fall back to copying
+            LOG_WARN("MSG_ZEROCOPY unavailable on socket {}, copying", fd);
+            zerocopy = false;
+            return Drained;
+        }
+        LOG_ERROR("zerocopy send on socket {} failed: {}", fd, strerror(errno));
+        return Failed;
+    }
+    frontZerocopied = true;
+    frontLastSequence = nextSequence++;
+    consume(sent);
+    return Drained;
+}
+
+OutputQueue::Result OutputQueue::flush(int fd) {
+    Result result = flushPlain(fd);
+    writeBlocked = (result == Blocked);
+    return result;
+}
+
+OutputQueue::Result OutputQueue::flushPlain(int fd) {
+    while (!buffers.empty()) {
+        if (zerocopy && buffers.front().size() - frontOffset >= zerocopyThreshold) {
+            Result result = sendZerocopy(fd);
+            if (result != Drained) return result;
+            continue;
+        }
+
+        static const unsigned int maxIov = 64;
+        iovec iov[maxIov];
+        unsigned int count = 0;
+        size_t offset = frontOffset;
+        for (std::deque<std::vector<char> >::iterator iter = buffers.begin();
+             iter != buffers.end() && count < maxIov;
+             ++iter) {
+            if (count > 0 && zerocopy && iter->size() >= zerocopyThreshold) break;
+            iov[count].iov_base = &(*iter)[offset];
+            iov[count].iov_len = iter->size() - offset;
+            offset = 0;
+            count++;
+        }
+
+        msghdr msg;
+        memset(&msg, 0, sizeof(msg));
+        msg.msg_iov = iov;
+        msg.msg_iovlen = count;
+        ssize_t sent = sendmsg(fd, &msg, MSG_NOSIGNAL);
+        if (sent < 0) {
+            if (errno == EINTR) continue;
+            if (errno == EAGAIN || errno == EWOULDBLOCK) return Blocked;
+            LOG_ERROR("writev on socket {} failed: {}", fd, strerror(errno));
+            return Failed;
+        }
+        consume(sent);
+    }
+    return Drained;
+}
+
+OutputQueue::Result OutputQueue::flushDatagrams(int fd) {
+    Result result = sendDatagrams(fd);
+    writeBlocked = (result == Blocked);
+    return result;
+}
+
+OutputQueue::Result OutputQueue::sendDatagrams(int fd) {
+    while (!buffers.empty()) {
+        static const unsigned int maxBatch = 64;
+        mmsghdr messages[maxBatch];
+        iovec iov[maxBatch];
+        unsigned int count = 0;
+        for (std::deque<std::vector<char> >::iterator iter = buffers.begin();
+             iter != buffers.end() && count < maxBatch;
+             ++iter) {
+            iov[count].iov_base = iter->empty() ? NULL : &(*iter)[0];
+            iov[count].iov_len = iter->size();
+            memset(&messages[count], 0, sizeof(messages[count]));
+            messages[count].msg_hdr.msg_iov = &iov[count];
+            messages[count].msg_hdr.msg_iovlen = 1;
+            count++;
+        }
+
+        int sent = sendmmsg(fd, messages, count, MSG_NOSIGNAL);
+        if (sent < 0) {
+            if (errno == EINTR) continue;
+            if (errno == EAGAIN || errno == EWOULDBLOCK) return Blocked;
+            if (errno == EMSGSIZE) {
+                // it can never go out, the ones behind it still can
+                LOG_WARN("dropping {} byte datagram on socket {}", buffers.front().size(), fd);
+                sent = 1;
+            } else {
+                LOG_ERROR("sendmmsg on socket {} failed: {}", fd, strerror(errno));
+                return Failed;
+            }
+        }
+        for (int i = 0; i < sent; i++) {
+            queuedBytes -= buffers.front().size();
+            buffers.pop_front();
+        }
+    }
+    return Drained;
+}
+
+OutputQueue::Result OutputQueue::flush(SSL* ssl) {
+    Result result = flushSecure(ssl);
+    writeBlocked = (result == Blocked);
+    return result;
+}
+
+OutputQueue::Result OutputQueue::flushSecure(SSL* ssl) {
+    while (!buffers.empty()) {
+        std::vector<char>& front = buffers.front();
+        size_t left = front.size() - frontOffset;
+        int chunk = left > INT_MAX ? INT_MAX : left;
+        int written = SSL_write(ssl, &front[frontOffset], chunk);
+        if (written <= 0) {
+            int err = SSL_get_error(ssl, written);
+            if (err == SSL_ERROR_WANT_WRITE || err == SSL_ERROR_WANT_READ) return Blocked;
+            LOG_ERROR("SSL_write failed with error {}", err);
+            return Failed;
+        }
+        consume(written);
+    }
+    return Drained;
+}
+
+void OutputQueue::discard() {
+    if (frontZerocopied) {
+        inFlight.push_back(InFlight());
+        inFlight.back().lastSequence = frontLastSequence;
+        inFlight.back().buffer.swap(buffers.front());
+        frontZerocopied = false;
+    }
+    buffers.clear();
+    frontOffset = 0;
+    queuedBytes = 0;
+    writeBlocked = false;
+}
+
+void OutputQueue::reapCompletions(int fd) {
+    while (zerocopyInFlight()) {
+        char control[128];
+        msghdr msg;
+        memset(&msg, 0, sizeof(msg));
+        msg.msg_control = control;
+        msg.msg_controllen = sizeof(control);
+        if (recvmsg(fd, &msg, MSG_ERRQUEUE) < 0) return;
+
+        for (cmsghdr* cm = CMSG_FIRSTHDR(&msg); cm != NULL; cm = CMSG_NXTHDR(&msg, cm)) {
+            bool recvErr = (cm->cmsg_level == SOL_IP && cm->cmsg_type == IP_RECVERR) ||
+                           (cm->cmsg_level == SOL_IPV6 && cm->cmsg_type == IPV6_RECVERR);
+            if (!recvErr) continue;
+            sock_extended_err* serr = reinterpret_cast<sock_extended_err*>(CMSG_DATA(cm));
+            if (serr->ee_errno != 0 || serr->ee_origin != SO_EE_ORIGIN_ZEROCOPY) continue;
+            // sends [ee_info, ee_data] are done
+            uint32_t last = serr->ee_data;
+            while (!inFlight.empty() &&
+                   int32_t(inFlight.front().lastSequence - last) <= 0) {
+                inFlight.pop_front();
+            }
+            // the kernel is done with the part of the front buffer it sent
+            if (frontZerocopied && int32_t(frontLastSequence - last) <= 0) {
+                frontZerocopied = false;
+            }
+        }
+    }
+}
@@ -0,0 +1,76 @@
+#ifndef OUTPUTQUEUE_H
+#define OUTPUTQUEUE_H
+
+#include <openssl/ossl_typ.h>
+
+#include <cstddef>
+#include <cstdint>
+#include <deque>
+#include <vector>
+
+// Outgoing buffers of one connection.  Buffers are written in order with
+// writev (plain) or SSL_write (secure); whatever the socket does not take
+// stays queued until the caller sees EPOLLOUT and flushes again.
+//
+// With zero copy enabled, plain buffers of at least the threshold size are
+// sent with MSG_ZEROCOPY and kept alive until the kernel reports their
+// completion on the socket error queue (see reapCompletions).
+//
+// On a datagram socket every buffer is sent as one datagram instead.
+class OutputQueue {
+public:
+    enum Result { Drained, Blocked, Failed };
+
+    OutputQueue();
+
+    void push(std::vector<char>& buffer);   // takes the contents of buffer
+    void push(const char* data, size_t length);
+
+    bool empty() const { return buffers.empty(); }
+    // true while the last flush left data behind because the socket was full
+    bool blocked() const { return writeBlocked; }
+    size_t pendingBytes() const { return queuedBytes; }
+    size_t pendingBuffers() const { return buffers.size(); }
+
+    // SO_ZEROCOPY must already be set on the socket
+    void enableZerocopy(size_t threshold);
+    // sent buffers, or the sent part of the front one, the kernel may still read
+    bool zerocopyInFlight() const { return !inFlight.empty() || frontZerocopied; }
+
+    Result flush(int fd);
+    Result flush(SSL* ssl);
+    Result flushDatagrams(int fd);
+
+    // release buffers whose MSG_ZEROCOPY sends the kernel has completed
+    void reapCompletions(int fd);
+    // drop everything not sent yet; a front buffer partly sent with
+    // MSG_ZEROCOPY moves to the in flight list instead
+    void discard();
+
+private:
+    Result flushPlain(int fd);
+    Result flushSecure(SSL* ssl);
+    Result sendDatagrams(int fd);
+    void consume(size_t bytes);
+    Result sendZerocopy(int fd);
+
+private:
+    std::deque<std::vector<char> > buffers;
+    size_t frontOffset;        // bytes of buffers.front() already written
+    size_t queuedBytes;
+    bool writeBlocked;
+
+    bool zerocopy;
+    size_t zerocopyThreshold;
+    uint32_t nextSequence;     // kernel numbers each MSG_ZEROCOPY send from 0
+    uint32_t frontLastSequence;
+    bool frontZerocopied;
+
+    struct InFlight {
+        uint32_t lastSequence;
+        std::vector<char> buffer;
+    };
+    std::deque<InFlight> inFlight;
+};
+
+#endif
@@ -0,0 +1,61 @@
+#include "RateLimiter.h"
+
+namespace {
+
+// slots inspected for a key before the stalest one is taken over
+const size_t probeLength = 8;
+
+}
+
+RateLimiter::RateLimiter(unsigned int slots)
+    : mask(0),
+      rate(0),
+      burst(0),
+      idleNanos(0),
+      evicted(0)
+{
+    size_t size = probeLength;
+    while (size < slots) size <<= 1;
+    Bucket empty = { 0, 0, 0 };
+    buckets.assign(size, empty);
+    mask = size - 1;
+}
+
+void RateLimiter::configure(double tokensPerSecond, double maximum) {
+    rate = tokensPerSecond;
+    burst = maximum < 1 ? 1 : maximum;
+    idleNanos = rate > 0 ? uint64_t(burst / rate * 1e9) : 0;
+}
+
+bool RateLimiter::allow(uint64_t key, uint64_t nowNanos) {
+    if (!enabled()) return true;
+    if (key == 0) key = 1;
+
+    Bucket* victim = NULL;
+    bool victimStale = false;
+    for (size_t i = 0; i < probeLength; i++) {
+        Bucket& bucket = buckets[(key + i) & mask];
+        if (bucket.key == key) {
+            bucket.tokens += (nowNanos - bucket.stamp) * rate / 1e9;
+            if (bucket.tokens > burst) bucket.tokens = burst;
+            bucket.stamp = nowNanos;
+            if (bucket.tokens < 1) return false;
+            bucket.tokens -= 1;
+            return true;
+        }
+        bool stale = (bucket.key == 0 || nowNanos - bucket.stamp >= idleNanos);
+        if (stale && !victimStale) {
+            victim = &bucket;
+            victimStale = true;
+        } else if (!victimStale && (victim == NULL || bucket.stamp < victim->stamp)) {
+            victim = &bucket;
+        }
+    }
+
+    // the key has no live bucket: start a full one
+    if (!victimStale) evicted++;
+    victim->key = key;
+    victim->stamp = nowNanos;
+    victim->tokens = burst - 1;
+    return true;
+}
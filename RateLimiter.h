@@ -0,0 +1,40 @@
+#ifndef RATELIMITER_H
+#define RATELIMITER_H
+
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+// Token buckets keyed by a 64 bit hash (a source address or prefix).  The
+// buckets live in a fixed, open-addressed table so a flood of distinct
+// sources costs no allocation.  A bucket idle long enough to have refilled
+// is as good as absent and its slot is reused; when a probe window is full
+// the stalest bucket is evicted.
+class RateLimiter {
+public:
+    explicit RateLimiter(unsigned int slots = 4096);
+
+    // rate in tokens per second, 0 turns the limiter off
+    void configure(double rate, double burst);
+    bool enabled() const { return rate > 0; }
+
+    // takes one token for key, false when its bucket is empty
+    bool allow(uint64_t key, uint64_t nowNanos);
+
+    uint64_t evictions() const { return evicted; }
+
+private:
+    struct Bucket {
+        uint64_t key;           // 0 marks an unused slot
+        uint64_t stamp;         // last refill
+        double tokens;
+    };
+    std::vector<Bucket> buckets;
+    size_t mask;
+    double rate;
+    double burst;
+    uint64_t idleNanos;         // time for an empty bucket to refill
+    uint64_t evicted;
+};
+
+#endif
@@ -0,0 +1,182 @@
+#include "SharedLoad.h"
+#include "Logger.h"
+
+#include <atomic>
+#include <cerrno>
+#include <cstring>
+#include <new>
+
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/eventfd.h>
+#include <fcntl.h>
+#include <unistd.h>
+
+struct SharedLoad::Region {
+    static const uint32_t expectedMagic = 0x4c4f4144;   // "LOAD"
+    static const uint32_t commandSlots = 16;            // power of two
+
+    uint32_t magic;
+
+    // load report, odd sequence while the worker is writing
+    alignas(64) std::atomic<uint32_t> sequence;
+    std::atomic<uint32_t> activeConnections;
+    std::atomic<uint32_t> queueDepth;
+    std::atomic<uint32_t> busyPermille;
+    std::atomic<uint64_t> accepted;
+    std::atomic<int32_t> cpu;
+    std::atomic<int32_t> node;
+
+    // commands from the connector
+    alignas(64) std::atomic<uint32_t> commandHead;
+    alignas(64) std::atomic<uint32_t> commandTail;
+    uint32_t commands[commandSlots];
+
+    Region()
+        : magic(expectedMagic),
+          sequence(0), activeConnections(0), queueDepth(0), busyPermille(0), accepted(0), cpu(-1), node(-1),
+          commandHead(0), commandTail(0)
+    {
+    }
+};
+
+SharedLoad::SharedLoad()
+    : region(0),
+      memFd(-1),
+      evFd(-1)
+{
+}
+
+bool SharedLoad::create() {
+    memFd = memfd_create("worker-load", MFD_CLOEXEC | MFD_ALLOW_SEALING);
+    if (memFd < 0) {
+        LOG_WARN("memfd_create failed: {}", strerror(errno));
+        return false;
+    }
+    if (ftruncate(memFd, sizeof(Region)) != 0) {
+        LOG_WARN("unable to size load region: {}", strerror(errno));
+        release();
+        return false;
+    }
+    // a region that shrinks under the connector's mapping would SIGBUS it
+    if (fcntl(memFd, F_ADD_SEALS, F_SEAL_SHRINK | F_SEAL_GROW | F_SEAL_SEAL) != 0) {
+        LOG_WARN("unable to seal load region: {}", strerror(errno));
+        release();
+        return false;
+    }
+    void* memory = mmap(NULL, sizeof(Region), PROT_READ|PROT_WRITE, MAP_SHARED, memFd, 0);
+    if (memory == MAP_FAILED) {
+        LOG_WARN("unable to map load region: {}", strerror(errno));
+        release();
+        return false;
+    }
+    region = new (memory) Region;
+    evFd = eventfd(0, EFD_NONBLOCK|EFD_CLOEXEC);
+    if (evFd < 0) {
+        LOG_WARN("eventfd failed: {}", strerror(errno));
+        release();
+        return false;
+    }
+    return true;
+}
+
+bool SharedLoad::attach(int newMemFd, int newEventFd) {
+    memFd = newMemFd;
+    evFd = newEventFd;
+    int seals = fcntl(memFd, F_GET_SEALS);
+    if (seals < 0 || !(seals & F_SEAL_SHRINK)) {
+        LOG_WARN("load region from worker is not sealed against shrinking");
+        release();
+        return false;
+    }
+    struct stat info;
+    if (fstat(memFd, &info) != 0 || info.st_size < (off_t)sizeof(Region)) {
+        LOG_WARN("load region from worker is too small");
+        release();
+        return false;
+    }
+    void* memory = mmap(NULL, sizeof(Region), PROT_READ|PROT_WRITE, MAP_SHARED, memFd, 0);
+    if (memory == MAP_FAILED) {
+        LOG_WARN("unable to map worker load region: {}", strerror(errno));
+        release();
+        return false;
+    }
+    region = static_cast<Region*>(memory);
+    if (region->magic != Region::expectedMagic) {
+        LOG_WARN("worker load region has a bad magic number");
+        release();
+        return false;
+    }
+    return true;
+}
+
+void SharedLoad::release() {
+    if (region != 0) munmap(region, sizeof(Region));
+    if (memFd >= 0) close(memFd);
+    if (evFd >= 0) close(evFd);
+    region = 0;
+    memFd = -1;
+    evFd = -1;
+}
+
+void SharedLoad::publish(const Snapshot& snapshot) {
+    uint32_t seq = region->sequence.load(std::memory_order_relaxed);
+    region->sequence.store(seq + 1, std::memory_order_relaxed);
+    std::atomic_thread_fence(std::memory_order_release);
+    region->activeConnections.store(snapshot.activeConnections, std::memory_order_relaxed);
+    region->queueDepth.store(snapshot.queueDepth, std::memory_order_relaxed);
+    region->busyPermille.store(snapshot.busyPermille, std::memory_order_relaxed);
+    region->accepted.store(snapshot.accepted, std::memory_order_relaxed);
+    region->cpu.store(snapshot.cpu, std::memory_order_relaxed);
+    region->node.store(snapshot.node, std::memory_order_relaxed);
+    region->sequence.store(seq + 2, std::memory_order_release);
+}
+
+bool SharedLoad::read(Snapshot& snapshot) const {
+    if (region == 0) return false;
+    // a worker that died half way through an update leaves the sequence
+    // odd for good, so give up after a while
+    for (unsigned int attempt = 0; attempt < 1000; attempt++) {
+        uint32_t before = region->sequence.load(std::memory_order_acquire);
+        if (before & 1) continue;
+        snapshot.activeConnections = region->activeConnections.load(std::memory_order_relaxed);
+        snapshot.queueDepth = region->queueDepth.load(std::memory_order_relaxed);
+        snapshot.busyPermille = region->busyPermille.load(std::memory_order_relaxed);
+        snapshot.accepted = region->accepted.load(std::memory_order_relaxed);
+        snapshot.cpu = region->cpu.load(std::memory_order_relaxed);
+        snapshot.node = region->node.load(std::memory_order_relaxed);
+        std::atomic_thread_fence(std::memory_order_acquire);
+        if (region->sequence.load(std::memory_order_relaxed) == before) return true;
+    }
+    return false;
+}
+
+bool SharedLoad::postCommand(uint32_t command) {
+    if (region == 0) return false;
+    uint32_t head = region->commandHead.load(std::memory_order_relaxed);
+    if (head - region->commandTail.load(std::memory_order_acquire) >= Region::commandSlots) {
+        return false;
+    }
+    region->commands[head & (Region::commandSlots - 1)] = command;
+    region->commandHead.store(head + 1, std::memory_order_release);
+    uint64_t one = 1;
+    if (::write(evFd, &one, sizeof(one)) != sizeof(one)) {
+        LOG_WARN("unable to signal worker command: {}", strerror(errno));
+    }
+    return true;
+}
+
+void SharedLoad::clearWakeup() {
+    uint64_t count;
+    if (::read(evFd, &count, sizeof(count)) < 0 && errno != EAGAIN) {
+        LOG_WARN("unable to read command eventfd: {}", strerror(errno));
+    }
+}
+
+bool SharedLoad::takeCommand(uint32_t& command) {
+    uint32_t tail = region->commandTail.load(std::memory_order_relaxed);
+    if (tail == region->commandHead.load(std::memory_order_acquire)) return false;
+    command = region->commands[tail & (Region::commandSlots - 1)];
+    region->commandTail.store(tail + 1, std::memory_order_release);
+    return true;
+}
@@ -0,0 +1,55 @@
+#ifndef SHAREDLOAD_H
+#define SHAREDLOAD_H
+
+#include <cstdint>
+
+// Memory region a worker shares with the connector.  The worker creates it
+// (memfd + eventfd) and passes both descriptors along with its
+// registration; the memfd is sealed at its size, and the connector takes
+// no other.  The worker publishes its load into seqlock-protected
+// fields that the connector reads without a system call.  The connector
+// passes the rare commands back through a small single-producer/single-
+// consumer ring and signals them on the eventfd.
+class SharedLoad {
+public:
+    enum Command { Retire = 1 };
+
+    struct Snapshot {
+        Snapshot() : activeConnections(0), queueDepth(0), busyPermille(0), accepted(0), cpu(-1), node(-1) {}
+        uint32_t activeConnections;
+        uint32_t queueDepth;        // ready events found in the last loop pass
+        uint32_t busyPermille;      // share of time spent outside epoll_wait
+        uint64_t accepted;          // hand-offs taken since registration
+        int32_t cpu;                // where the event loop last ran, -1 unknown
+        int32_t node;               // NUMA node of cpu
+    };
+
+    SharedLoad();
+
+    bool create();                          // worker side
+    bool attach(int memFd, int eventFd);    // connector side, owns the fds afterwards
+    void release();
+    bool valid() const { return region != 0; }
+
+    int memoryFd() const { return memFd; }
+    int eventFd() const { return evFd; }
+
+    // worker side
+    void publish(const Snapshot& snapshot);
+    // call clearWakeup when the eventfd is readable, then take commands
+    // until none are left
+    void clearWakeup();
+    bool takeCommand(uint32_t& command);
+
+    // connector side
+    bool read(Snapshot& snapshot) const;
+    bool postCommand(uint32_t command);
+
+private:
+    struct Region;
+    Region* region;
+    int memFd;
+    int evFd;
+};
+
+#endif
@@ -0,0 +1,202 @@
+#include "Sink.h"
+#include "Logger.h"
+
+#include <cerrno>
+#include <cstring>
+#include <sstream>
+
+#include <fcntl.h>
+#include <sys/file.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+namespace {
+
+// bytes moved per splice call; the pipe is grown to match
+const size_t chunkSize = 1 << 20;
+const unsigned int chunksPerPump = Sink::bytesPerPump / chunkSize;
+
+}
+
+Sink::Sink()
+    : directory(false),
+      sharedFile(-1),
+      identifier(0),
+      rotateBytes(0),
+      syncPolicy(SyncNone),
+      syncBytes(0),
+      streams(0),
+      total(0)
+{
+}
+
+Sink::~Sink() {
+    if (sharedFile >= 0) {
+        if (syncPolicy != SyncNone) fdatasync(sharedFile);
+        ::close(sharedFile);
+    }
+}
+
+bool Sink::parseSyncPolicy(const std::string& name, SyncPolicy& policy) {
+    if (name == "none") policy = SyncNone;
+    else if (name == "close") policy = SyncClose;
+    else if (name == "periodic") policy = SyncPeriodic;
+    else return false;
+    return true;
+}
+
+bool Sink::configure(const std::string& path, unsigned int id,
+                     uint64_t rotate, SyncPolicy sync, uint64_t every) {
+    target = path;
+    identifier = id;
+    rotateBytes = rotate;
+    syncPolicy = sync;
+    syncBytes = every;
+
+    struct stat info;
+    directory = (stat(path.c_str(), &info) == 0 && S_ISDIR(info.st_mode));
+    if (directory) return true;
+
+    // O_RDWR keeps a FIFO open without waiting for its reader; writes
+    // block while the reader falls behind, which is the back pressure we want
+    bool fifo = (stat(path.c_str(), &info) == 0 && S_ISFIFO(info.st_mode));
+    if (fifo) {
+        LOG_WARN("sink {} is a FIFO, the worker stalls while its reader does", path);
+    }
+    // splice refuses O_APPEND files, so a file target is written at its
+    // own offset, which starts at the end and belongs to this worker alone
+    sharedFile = ::open(path.c_str(), fifo ? O_RDWR|O_CLOEXEC : O_WRONLY|O_CREAT|O_CLOEXEC, 0644);
+    if (fifo) {
+        // nothing to make durable
+        syncPolicy = SyncNone;
+    }
+    if (sharedFile < 0) {
+        LOG_ERROR("unable to open sink {}: {}", path, strerror(errno));
+        target.clear();
+        return false;
+    }
+    if (!fifo) {
+        if (flock(sharedFile, LOCK_EX|LOCK_NB) != 0) {
+            LOG_ERROR("sink {} is in use by another worker, give each its own file or a directory", path);
+            ::close(sharedFile);
+            sharedFile = -1;
+            target.clear();
+            return false;
+        }
+        lseek(sharedFile, 0, SEEK_END);
+    }
+    return true;
+}
+
+bool Sink::open(Stream& stream) {
+    // a blocking pipe: reads from the socket pass SPLICE_F_NONBLOCK, and
+    // O_NONBLOCK here would make the splice into a full FIFO fail
+    if (pipe2(stream.pipe, O_CLOEXEC) != 0) {
+        LOG_ERROR("sink pipe: {}", strerror(errno));
+        return false;
+    }
+    // a bigger pipe means fewer splice calls per megabyte; failure is harmless
+    fcntl(stream.pipe[1], F_SETPIPE_SZ, chunkSize);
+    stream.number = streams++;
+    stream.part = 0;
+    return openFile(stream);
+}
+
+bool Sink::openFile(Stream& stream) {
+    stream.written = 0;
+    stream.unsynced = 0;
+    if (!directory) {
+        stream.file = sharedFile;
+        return true;
+    }
+    std::stringstream name;
+    name << target << "/" << identifier << "-" << getpid() << "-" << stream.number << "." << stream.part;
+    stream.file = ::open(name.str().c_str(), O_WRONLY|O_CREAT|O_TRUNC|O_CLOEXEC, 0644);
+    if (stream.file < 0) {
+        LOG_ERROR("unable to create sink file {}: {}", name.str(), strerror(errno));
+        return false;
+    }
+    return true;
+}
+
+Sink::Result Sink::pump(Stream& stream, int socket) {
+    for (unsigned int chunk = 0; chunk < chunksPerPump; chunk++) {
+        ssize_t in = splice(socket, NULL, stream.pipe[1], NULL, chunkSize, SPLICE_F_MOVE|SPLICE_F_NONBLOCK);
+        if (in == 0) return Closed;
+        if (in < 0) {
+            if (errno == EAGAIN || errno == EWOULDBLOCK) return Drained;
+            if (errno == EINTR) continue;
+            // a kTLS socket reports non-data records (alerts) this way
+            LOG_INFO("sink splice from socket {}: {}", socket, strerror(errno));
+            return Failed;
+        }
+        if (!rotate(stream)) return Failed;
+        // the target side blocks, so the pipe is empty again afterwards
+        size_t left = in;
+        while (left > 0) {
+            ssize_t out = splice(stream.pipe[0], NULL, stream.file, NULL, left, SPLICE_F_MOVE);
+            if (out < 0 && errno == EINTR) continue;
+            if (out <= 0) {
+                LOG_ERROR("sink splice to target: {}", strerror(errno));
+                return Failed;
+            }
+            left -= out;
+        }
+        account(stream, in);
+    }
+    return Busy;
+}
+
+bool Sink::write(Stream& stream, const char* data, size_t length) {
+    if (!rotate(stream)) return false;
+    size_t left = length;
+    while (left > 0) {
+        ssize_t out = ::write(stream.file, data + (length - left), left);
+        if (out < 0 && errno == EINTR) continue;
+        if (out <= 0) {
+            LOG_ERROR("sink write: {}", strerror(errno));
+            return false;
+        }
+        left -= out;
+    }
+    account(stream, length);
+    return true;
+}
+
+bool Sink::rotate(Stream& stream) {
+    if (!directory || rotateBytes == 0 || stream.written < rotateBytes) return true;
+    if (syncPolicy != SyncNone) sync(stream);
+    ::close(stream.file);
+    stream.file = -1;
+    stream.part++;
+    return openFile(stream);
+}
+
+void Sink::account(Stream& stream, size_t bytes) {
+    total += bytes;
+    stream.written += bytes;
+    stream.unsynced += bytes;
+    if (syncPolicy == SyncPeriodic && stream.unsynced >= syncBytes) {
+        sync(stream);
+    }
+}
+
+void Sink::sync(Stream& stream) {
+    if (stream.unsynced == 0) return;
+    if (fdatasync(stream.file) != 0) {
+        LOG_WARN("sink fdatasync: {}", strerror(errno));
+    }
+    stream.unsynced = 0;
+}
+
+void Sink::close(Stream& stream) {
+    if (stream.file >= 0) {
+        if (syncPolicy != SyncNone) sync(stream);
+        if (directory) ::close(stream.file);
+        stream.file = -1;
+    }
+    for (int i = 0; i < 2; i++) {
+        if (stream.pipe[i] >= 0) ::close(stream.pipe[i]);
+        stream.pipe[i] = -1;
+    }
+}
@@ -0,0 +1,74 @@
+#ifndef SINK_H
+#define SINK_H
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+
+// Persists connection streams without passing them through user space.
+// Bytes move socket -> pipe -> target with splice.  The target is either a
+// directory, where every connection gets its own file that is rotated by
+// size, or a single file or FIFO that all connections append to (their
+// data interleaves in splice sized chunks).  A single file is locked by
+// the worker that writes it; several workers need a directory or a FIFO.
+// Writes to the target block: a FIFO reader that stops reading stalls the
+// whole worker, handshakes and connector commands included.
+//
+// Data that already is in user space, like records a TLS library
+// decrypted, goes through write().
+class Sink {
+public:
+    enum SyncPolicy { SyncNone, SyncClose, SyncPeriodic };
+    // Busy: the per call budget ran out with data left in the socket
+    enum Result { Drained, Busy, Closed, Failed };
+
+    struct Stream {
+        Stream() : file(-1), written(0), unsynced(0), number(0), part(0) { pipe[0] = pipe[1] = -1; }
+        int pipe[2];
+        int file;
+        uint64_t written;       // into the current file
+        uint64_t unsynced;
+        uint64_t number;        // connection number, names the files
+        unsigned int part;
+    };
+
+    Sink();
+    ~Sink();
+
+    bool configure(const std::string& target, unsigned int identifier,
+                   uint64_t rotateBytes, SyncPolicy sync, uint64_t syncBytes);
+    bool enabled() const { return !target.empty(); }
+    static bool parseSyncPolicy(const std::string& name, SyncPolicy& policy);
+
+    // bytes one pump call, or one pass of copying, may move before the
+    // other connections get their turn
+    static const size_t bytesPerPump = 16 << 20;
+
+    bool open(Stream& stream);
+    // move what the socket has, until it would block or the budget for
+    // one call is spent; level triggered epoll brings a Busy stream back
+    Result pump(Stream& stream, int socket);
+    bool write(Stream& stream, const char* data, size_t length);
+    void close(Stream& stream);
+
+    uint64_t totalBytes() const { return total; }
+
+private:
+    bool openFile(Stream& stream);
+    // called before data goes to the target, opens the next part when due
+    bool rotate(Stream& stream);
+    void account(Stream& stream, size_t bytes);
+    void sync(Stream& stream);
+
+    std::string target;
+    bool directory;
+    int sharedFile;             // single file or FIFO target
+    unsigned int identifier;
+    uint64_t rotateBytes;
+    SyncPolicy syncPolicy;
+    uint64_t syncBytes;
+    uint64_t streams;
+    uint64_t total;
+};
+
+#endif
@@ -0,0 +1,220 @@
+#include "Supervisor.h"
+#include "Logger.h"
+
+#include <cerrno>
+#include <cstdio>
+#include <cstring>
+#include <sstream>
+
+#include <signal.h>
+#include <sys/signalfd.h>
+#include <sys/syscall.h>
+#include <sys/timerfd.h>
+#include <sys/wait.h>
+#include <time.h>
+#include <unistd.h>
+
+namespace {
+
+// a child that dies this soon is restarted on the next tick, not at once
+const uint64_t earlyExitMs = 1000;
+
+uint64_t monotonicMillis() {
+    timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return uint64_t(now.tv_sec) * 1000 + now.tv_nsec / 1000000;
+}
+
+void closeInherited() {
+#ifdef SYS_close_range
+    if (syscall(SYS_close_range, 3, ~0U, 0) == 0) return;
+#endif
+    for (int fd = 3; fd < 1024; fd++) close(fd);
+}
+
+}
+
+Supervisor::Supervisor()
+    : nextCpu(0),
+      sigFd(-1),
+      tickFd(-1),
+      interval(0),
+      stopRequested(false)
+{
+}
+
+Supervisor::~Supervisor() {
+    if (sigFd >= 0) close(sigFd);
+    if (tickFd >= 0) close(tickFd);
+}
+
+bool Supervisor::blockSignals() {
+    sigset_t mask;
+    sigemptyset(&mask);
+    sigaddset(&mask, SIGCHLD);
+    sigaddset(&mask, SIGTERM);
+    sigaddset(&mask, SIGINT);
+    if (sigprocmask(SIG_BLOCK, &mask, NULL) != 0) {
+        perror("unable to block SIGCHLD");
+        return false;
+    }
+    return true;
+}
+
+bool Supervisor::unblockStopSignals() {
+    sigset_t mask;
+    sigemptyset(&mask);
+    sigaddset(&mask, SIGTERM);
+    sigaddset(&mask, SIGINT);
+    if (sigprocmask(SIG_UNBLOCK, &mask, NULL) != 0) {
+        perror("unable to unblock SIGTERM");
+        return false;
+    }
+    return true;
+}
+
+bool Supervisor::start(const std::string& workerPath,
+                       const std::vector<std::string>& workerArguments,
+                       const std::string& domainPath,
+                       bool seqpacket,
+                       unsigned int tickMs,
+                       const std::vector<int>& workerCpus) {
+    cpus = workerCpus;
+    baseArguments.clear();
+    baseArguments.push_back(workerPath);
+    baseArguments.push_back("--domainPath");
+    baseArguments.push_back(domainPath);
+    if (seqpacket) baseArguments.push_back("--seqpacket");
+    baseArguments.insert(baseArguments.end(), workerArguments.begin(), workerArguments.end());
+
+    if (!blockSignals()) return false;
+    sigset_t mask;
+    sigemptyset(&mask);
+    sigaddset(&mask, SIGCHLD);
+    sigaddset(&mask, SIGTERM);
+    sigaddset(&mask, SIGINT);
+    sigFd = signalfd(-1, &mask, SFD_NONBLOCK | SFD_CLOEXEC);
+    if (sigFd < 0) {
+        perror("unable to create signalfd");
+        return false;
+    }
+
+    interval = tickMs ? tickMs : 1000;
+    tickFd = timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK | TFD_CLOEXEC);
+    if (tickFd < 0) {
+        perror("unable to create timerfd");
+        return false;
+    }
+    itimerspec period;
+    period.it_interval.tv_sec = interval / 1000;
+    period.it_interval.tv_nsec = (interval % 1000) * 1000000;
+    period.it_value = period.it_interval;
+    if (timerfd_settime(tickFd, 0, &period, NULL) != 0) {
+        perror("unable to arm timerfd");
+        return false;
+    }
+    return true;
+}
+
+pid_t Supervisor::spawn(const PoolKey& pool) {
+    std::vector<std::string> arguments(baseArguments);
+    std::stringstream identifier;
+    identifier << pool.first;
+    arguments.push_back("--identifier");
+    arguments.push_back(identifier.str());
+    if (pool.second) arguments.push_back("--secure");
+    if (!cpus.empty()) {
+        std::stringstream cpu;
+        cpu << cpus[nextCpu++ % cpus.size()];
+        arguments.push_back("--cpus");
+        arguments.push_back(cpu.str());
+    }
+
+    std::vector<char*> argv;
+    for (size_t i = 0; i < arguments.size(); i++) {
+        argv.push_back(const_cast<char*>(arguments[i].c_str()));
+    }
+    argv.push_back(NULL);
+
+    pid_t pid = fork();
+    if (pid < 0) {
+        LOG_ERROR("unable to fork worker: {}", strerror(errno));
+        return pid;
+    }
+    if (pid == 0) {
+        // nothing of the connector leaks into the worker
+        sigset_t none;
+        sigemptyset(&none);
+        sigprocmask(SIG_SETMASK, &none, NULL);
+        closeInherited();
+        execv(argv[0], &argv[0]);
+        perror("unable to exec worker");
+        _exit(127);
+    }
+
+    Child child;
+    child.pool = pool;
+    child.started = monotonicMillis();
+    child.retiring = false;
+    children[pid] = child;
+    LOG_INFO("started worker pid {} for {} secure {}", pid, pool.first, pool.second);
+    return pid;
+}
+
+void Supervisor::retire(pid_t pid) {
+    std::map<pid_t, Child>::iterator child = children.find(pid);
+    if (child != children.end()) child->second.retiring = true;
+}
+
+unsigned int Supervisor::count(const PoolKey& pool) const {
+    unsigned int total = 0;
+    for (std::map<pid_t, Child>::const_iterator child = children.begin(); child != children.end(); ++child) {
+        if (child->second.pool == pool && !child->second.retiring) total++;
+    }
+    return total;
+}
+
+void Supervisor::reap(std::vector<Exit>& exits) {
+    signalfd_siginfo info;
+    while (read(sigFd, &info, sizeof(info)) == sizeof(info)) {
+        // SIGCHLD coalesces, waitpid below finds every child
+        if (info.ssi_signo == SIGTERM || info.ssi_signo == SIGINT) {
+            stopRequested = true;
+        }
+    }
+
+    uint64_t now = monotonicMillis();
+    int status;
+    pid_t pid;
+    while ((pid = waitpid(-1, &status, WNOHANG)) > 0) {
+        std::map<pid_t, Child>::iterator child = children.find(pid);
+        if (child == children.end()) continue;
+        Exit exit;
+        exit.pid = pid;
+        exit.pool = child->second.pool;
+        exit.expected = child->second.retiring;
+        exit.early = now - child->second.started < earlyExitMs;
+        if (!exit.expected) {
+            if (WIFSIGNALED(status)) {
+                LOG_WARN("worker pid {} killed by signal {}", pid, WTERMSIG(status));
+            } else {
+                LOG_WARN("worker pid {} exited with status {}", pid, WEXITSTATUS(status));
+            }
+        }
+        children.erase(child);
+        exits.push_back(exit);
+    }
+}
+
+uint64_t Supervisor::clearTick() {
+    uint64_t expirations = 0;
+    if (read(tickFd, &expirations, sizeof(expirations)) != sizeof(expirations)) return 0;
+    return expirations;
+}
+
+void Supervisor::stopAll() {
+    for (std::map<pid_t, Child>::iterator child = children.begin(); child != children.end(); ++child) {
+        child->second.retiring = true;
+        kill(child->first, SIGTERM);
+    }
+}
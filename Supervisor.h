@@ -0,0 +1,80 @@
+#ifndef SUPERVISOR_H
+#define SUPERVISOR_H
+
+#include <sys/types.h>
+
+#include <map>
+#include <string>
+#include <utility>
+#include <vector>
+
+// Starts and tracks worker processes for the connector.  Children are
+// reaped through a signalfd for SIGCHLD and the scaling tick is a timerfd,
+// so both show up in the connector's epoll set like any other descriptor.
+// The supervisor only manages processes; how many are wanted is decided by
+// the connector, which sees assignments and the workers' load reports.
+class Supervisor {
+public:
+    typedef std::pair<unsigned int, bool> PoolKey;     // identifier, secure
+
+    struct Exit {
+        pid_t pid;
+        PoolKey pool;
+        bool expected;      // retired by us
+        bool early;         // died shortly after it was started
+    };
+
+    Supervisor();
+    ~Supervisor();
+
+    // SIGCHLD, SIGTERM and SIGINT must be blocked in every thread for the
+    // signalfd to see them, so this runs before the process starts any thread
+    static bool blockSignals();
+    // without a supervisor the calling thread takes SIGTERM and SIGINT again
+    static bool unblockStopSignals();
+
+    // workerArguments are passed after the ones the supervisor sets itself
+    bool start(const std::string& workerPath,
+               const std::vector<std::string>& workerArguments,
+               const std::string& domainPath,
+               bool seqpacket,
+               unsigned int tickMs,
+               const std::vector<int>& cpus);
+    bool running() const { return sigFd >= 0; }
+    int signalFd() const { return sigFd; }
+    int timerFd() const { return tickFd; }
+    // SIGTERM or SIGINT arrived; the owner shuts down and calls stopAll
+    bool stopping() const { return stopRequested; }
+
+    pid_t spawn(const PoolKey& pool);
+    // the process is going away on purpose, do not count it any more
+    void retire(pid_t pid);
+    bool supervises(pid_t pid) const { return children.count(pid) != 0; }
+    // children of the pool that are starting or serving
+    unsigned int count(const PoolKey& pool) const;
+
+    // call when signalFd is readable
+    void reap(std::vector<Exit>& exits);
+    // call when timerFd is readable, returns the ticks that elapsed
+    uint64_t clearTick();
+
+    // SIGTERM to every child
+    void stopAll();
+
+private:
+    struct Child {
+        PoolKey pool;
+        uint64_t started;
+        bool retiring;
+    };
+    std::map<pid_t, Child> children;
+    std::vector<std::string> baseArguments;
+    std::vector<int> cpus;      // handed out to new children in turn
+    unsigned int nextCpu;
+    int sigFd;
+    int tickFd;
+    unsigned int interval;
+    bool stopRequested;
+};
+
+#endif
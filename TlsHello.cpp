@@ -0,0 +1,97 @@
+#include "TlsHello.h"
+
+namespace {
+
+const unsigned char handshakeRecord = 22;
+const unsigned char clientHelloType = 1;
+const unsigned int serverNameExtension = 0;
+const unsigned int alpnExtension = 16;
+
+// bounds checked big endian reader over one buffer
+class Reader {
+public:
+    Reader(const unsigned char* data, size_t length) : data(data), left(length), failed(false) {}
+
+    unsigned int number(size_t bytes) {
+        if (bytes > left) { failed = true; left = 0; return 0; }
+        unsigned int value = 0;
+        for (size_t i = 0; i < bytes; i++) value = (value << 8) | data[i];
+        data += bytes;
+        left -= bytes;
+        return value;
+    }
+    // a sub reader over the next length bytes
+    Reader take(size_t length) {
+        if (length > left) { failed = true; length = left; }
+        Reader sub(data, length);
+        sub.failed = failed;
+        data += length;
+        left -= length;
+        return sub;
+    }
+    void skip(size_t length) { take(length); }
+
+    const unsigned char* data;
+    size_t left;
+    bool failed;
+};
+
+}
+
+ClientHello::Result ClientHello::parse(const unsigned char* bytes, size_t length) {
+    serverName.clear();
+    protocols.clear();
+
+    // record header: type, version, length
+    if (length < 1) return Incomplete;
+    if (bytes[0] != handshakeRecord) return NotTls;
+    if (length < 5) return Incomplete;
+    if (bytes[1] != 3) return NotTls;
+    size_t recordLength = (bytes[3] << 8) | bytes[4];
+    if (recordLength == 0 || recordLength > maxRecord - 5) return Malformed;
+
+    // the handshake header tells us early when the hello is split over records
+    if (length >= 9) {
+        if (bytes[5] != clientHelloType) return NotTls;
+        size_t helloLength = (bytes[6] << 16) | (bytes[7] << 8) | bytes[8];
+        if (helloLength + 4 > recordLength) return Malformed;
+    }
+    if (length < 5 + recordLength) return Incomplete;
+
+    Reader record(bytes + 5, recordLength);
+    record.skip(1);                                 // handshake type
+    Reader hello = record.take(record.number(3));
+    hello.skip(2 + 32);                             // version, random
+    hello.skip(hello.number(1));                    // session id
+    hello.skip(hello.number(2));                    // cipher suites
+    hello.skip(hello.number(1));                    // compression methods
+    if (hello.failed) return Malformed;
+    if (hello.left == 0) return Complete;           // no extensions
+
+    Reader extensions = hello.take(hello.number(2));
+    while (extensions.left > 0 && !extensions.failed) {
+        unsigned int type = extensions.number(2);
+        Reader body = extensions.take(extensions.number(2));
+        if (type == serverNameExtension) {
+            Reader names = body.take(body.number(2));
+            while (names.left > 0 && !names.failed) {
+                unsigned int nameType = names.number(1);
+                Reader name = names.take(names.number(2));
+                if (nameType == 0 && !name.failed) {
+                    serverName.assign(reinterpret_cast<const char*>(name.data), name.left);
+                }
+            }
+            if (names.failed) return Malformed;
+        } else if (type == alpnExtension) {
+            Reader list = body.take(body.number(2));
+            while (list.left > 0 && !list.failed) {
+                Reader protocol = list.take(list.number(1));
+                if (!protocol.failed) {
+                    protocols.push_back(std::string(reinterpret_cast<const char*>(protocol.data), protocol.left));
+                }
+            }
+            if (list.failed) return Malformed;
+        }
+    }
+    return extensions.failed ? Malformed : Complete;
+}
@@ -0,0 +1,26 @@
+#ifndef TLSHELLO_H
+#define TLSHELLO_H
+
+#include <cstddef>
+#include <string>
+#include <vector>
+
+// Reads the server name (SNI) and ALPN protocols out of a TLS ClientHello
+// without a TLS library.  The connector uses it on peeked bytes, so the
+// parser never consumes anything and tells a short read (more bytes are
+// needed) apart from data that is not a ClientHello at all.
+struct ClientHello {
+    enum Result { Complete, Incomplete, NotTls, Malformed };
+
+    // the first record must hold the whole ClientHello; every common
+    // client sends it in one record
+    Result parse(const unsigned char* data, size_t length);
+
+    std::string serverName;
+    std::vector<std::string> protocols;
+
+    // largest record the parser will wait for
+    static const size_t maxRecord = 5 + 16384;
+};
+
+#endif
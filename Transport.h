@@ -0,0 +1,107 @@
+#ifndef TRANSPORT_H
+#define TRANSPORT_H
+
+#include "OutputQueue.h"
+
+#include <openssl/ssl.h>
+#include <openssl/bio.h>
+
+#include <cerrno>
+#include <cstddef>
+#include <sys/socket.h>
+
+// Byte level I/O of one client connection.  Worker's event loop is a
+// template over these policies and run() picks one at startup, so each
+// build of the loop inlines only its own read, write and close.
+//
+// read and write return the bytes moved, 0 when the peer closed and -1 on
+// error; retry is set when the call would have blocked.  buffered tells
+// whether a read has more to give without the socket turning readable.
+
+struct PlainTransport {
+    static const bool secure = false;
+    static const char* name() { return "plain"; }
+
+    static int read(int fd, SSL*, char* data, size_t length, bool& retry) {
+        int bytes = recv(fd, data, length, 0);
+        retry = (bytes < 0 && (errno == EAGAIN || errno == EWOULDBLOCK));
+        return bytes;
+    }
+    static int write(int fd, SSL*, const char* data, size_t length, bool& retry) {
+        int bytes = send(fd, data, length, MSG_NOSIGNAL);
+        retry = (bytes < 0 && (errno == EAGAIN || errno == EWOULDBLOCK));
+        return bytes;
+    }
+    static OutputQueue::Result flush(OutputQueue& queue, int fd, SSL*) {
+        return queue.flush(fd);
+    }
+    static bool buffered(SSL*) { return false; }
+    static bool usable(SSL*) { return true; }
+    static void shutdown(SSL*) {}
+};
+
+// OpenSSL's record layer in user space
+struct TlsTransport {
+    static const bool secure = true;
+    static const char* name() { return "tls"; }
+
+    static int read(int, SSL* ssl, char* data, size_t length, bool& retry) {
+        int bytes = SSL_read(ssl, data, length);
+        retry = false;
+        if (bytes <= 0) {
+            int err = SSL_get_error(ssl, bytes);
+            retry = (err == SSL_ERROR_WANT_READ || err == SSL_ERROR_WANT_WRITE);
+            if (err == SSL_ERROR_ZERO_RETURN) return 0;
+            return -1;
+        }
+        return bytes;
+    }
+    static int write(int, SSL* ssl, const char* data, size_t length, bool& retry) {
+        int bytes = SSL_write(ssl, data, length);
+        retry = false;
+        if (bytes <= 0) {
+            int err = SSL_get_error(ssl, bytes);
+            retry = (err == SSL_ERROR_WANT_READ || err == SSL_ERROR_WANT_WRITE);
+            return -1;
+        }
+        return bytes;
+    }
+    static OutputQueue::Result flush(OutputQueue& queue, int, SSL* ssl) {
+        return queue.flush(ssl);
+    }
+    // the rest of a record OpenSSL decrypted already
+    static bool buffered(SSL* ssl) { return SSL_pending(ssl) > 0; }
+    static bool usable(SSL*) { return true; }
+    static void shutdown(SSL* ssl) { SSL_shutdown(ssl); }
+};
+
+// TLS with both directions of the record layer in the kernel.  After the
+// handshake the connection is a plain socket to us; the SSL object is only
+// kept for the close_notify.  A record that is not application data makes
+// recv fail with EIO, which ends the connection.
+struct KernelTlsTransport {
+    static const bool secure = true;
+    static const char* name() { return "ktls"; }
+
+    static int read(int fd, SSL* ssl, char* data, size_t length, bool& retry) {
+        return PlainTransport::read(fd, ssl, data, length, retry);
+    }
+    static int write(int fd, SSL* ssl, const char* data, size_t length, bool& retry) {
+        return PlainTransport::write(fd, ssl, data, length, retry);
+    }
+    static OutputQueue::Result flush(OutputQueue& queue, int fd, SSL*) {
+        return queue.flush(fd);
+    }
+    static bool buffered(SSL*) { return false; }
+    static bool usable(SSL* ssl) {
+#ifndef OPENSSL_NO_KTLS
+        return BIO_get_ktls_send(SSL_get_wbio(ssl)) && BIO_get_ktls_recv(SSL_get_rbio(ssl));
+#else
+        (void)ssl;
+        return false;
+#endif
+    }
+    static void shutdown(SSL* ssl) { SSL_shutdown(ssl); }
+};
+
+#endif
@@ -0,0 +1,190 @@
+#include "TransportBenchmark.h"
+#include "Transport.h"
+
+#include <cstdio>
+#include <cstring>
+#include <ctime>
+#include <functional>
+#include <iostream>
+#include <thread>
+#include <vector>
+
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <arpa/inet.h>
+#include <unistd.h>
+
+#include <openssl/ssl.h>
+#include <openssl/err.h>
+
+namespace {
+
+uint64_t monotonicNanos() {
+    timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return uint64_t(now.tv_sec) * 1000000000ull + now.tv_nsec;
+}
+
+// moves exactly length bytes with a blocking transport call, false on error
+template<class Data>
+bool transfer(int (*move)(int, SSL*, Data, size_t, bool&), int fd, SSL* ssl, Data data, size_t length) {
+    size_t done = 0;
+    while (done < length) {
+        bool retry = false;
+        int bytes = move(fd, ssl, data + done, length - done, retry);
+        if (bytes <= 0) {
+            if (retry) continue;
+            return false;
+        }
+        done += bytes;
+    }
+    return true;
+}
+
+}
+
+TransportBenchmark::TransportBenchmark(SSL_CTX* server, unsigned int count, unsigned int size)
+    : serverCtx(server),
+      clientCtx(SSL_CTX_new(TLS_client_method())),
+      messages(count),
+      messageSize(size)
+{
+    if (NULL == clientCtx) {
+        std::cerr << "unable to create SSL ctx" << std::endl;
+        abort();
+    }
+    SSL_CTX_set_verify(clientCtx, SSL_VERIFY_NONE, NULL);
+    SSL_CTX_set_min_proto_version(clientCtx, TLS1_2_VERSION);
+}
+
+TransportBenchmark::~TransportBenchmark() {
+    SSL_CTX_free(clientCtx);
+}
+
+void TransportBenchmark::run() {
+    std::cout << messages << " round trips of " << messageSize << " bytes over loopback" << std::endl;
+    uint64_t plain = measure<PlainTransport>(false);
+    uint64_t tls = measure<TlsTransport>(false);
+    uint64_t ktls = measure<KernelTlsTransport>(true);
+
+    const char* names[] = { PlainTransport::name(), TlsTransport::name(), KernelTlsTransport::name() };
+    uint64_t results[] = { plain, tls, ktls };
+    for (int i = 0; i < 3; i++) {
+        if (results[i] == 0) {
+            printf("%-6s unavailable\n", names[i]);
+            continue;
+        }
+        printf("%-6s %8llu ns per round trip, %+8lld ns over plain\n", names[i],
+               (unsigned long long)results[i], (long long)results[i] - (long long)plain);
+    }
+}
+
+template<class Transport>
+uint64_t TransportBenchmark::measure(bool kernelTls) {
+    int clientFd, serverFd;
+    if (!connectedPair(clientFd, serverFd)) return 0;
+
+    uint64_t nanos = 0;
+    bool secure = Transport::secure;
+    std::thread client(&TransportBenchmark::runClient, this, clientFd, secure, std::ref(nanos));
+
+    SSL* ssl = NULL;
+    bool ok = true;
+    if (Transport::secure) {
+        ssl = SSL_new(serverCtx);
+#ifdef SSL_OP_ENABLE_KTLS
+        if (kernelTls) {
+            SSL_set_options(ssl, SSL_OP_ENABLE_KTLS);
+        } else {
+            SSL_clear_options(ssl, SSL_OP_ENABLE_KTLS);
+        }
+#else
+        (void)kernelTls;
+#endif
+        SSL_set_fd(ssl, serverFd);
+        ok = (SSL_accept(ssl) == 1) && Transport::usable(ssl);
+    }
+
+    // echo every message back, the client times the round trips
+    std::vector<char> buffer(messageSize);
+    for (unsigned int i = 0; ok && i < messages; i++) {
+        ok = transfer<char*>(&Transport::read, serverFd, ssl, &buffer[0], messageSize) &&
+             transfer<const char*>(&Transport::write, serverFd, ssl, &buffer[0], messageSize);
+    }
+    if (ssl) {
+        if (ok) Transport::shutdown(ssl);
+        SSL_free(ssl);
+    }
+    // unblocks a client still waiting for a reply
+    shutdown(serverFd, SHUT_RDWR);
+    client.join();
+    close(serverFd);
+    return ok ? nanos : 0;
+}
+
+void TransportBenchmark::runClient(int fd, bool secure, uint64_t& nanos) {
+    SSL* ssl = NULL;
+    if (secure) {
+        ssl = SSL_new(clientCtx);
+        SSL_set_fd(ssl, fd);
+        if (SSL_connect(ssl) != 1) {
+            SSL_free(ssl);
+            close(fd);
+            return;
+        }
+    }
+    std::vector<char> message(messageSize, 'x');
+    std::vector<char> reply(messageSize);
+    uint64_t start = monotonicNanos();
+    unsigned int done = 0;
+    for (; done < messages; done++) {
+        bool ok = secure ?
+            transfer<const char*>(&TlsTransport::write, fd, ssl, &message[0], messageSize) &&
+            transfer<char*>(&TlsTransport::read, fd, ssl, &reply[0], messageSize) :
+            transfer<const char*>(&PlainTransport::write, fd, ssl, &message[0], messageSize) &&
+            transfer<char*>(&PlainTransport::read, fd, ssl, &reply[0], messageSize);
+        if (!ok) break;
+    }
+    if (done == messages && messages > 0) {
+        nanos = (monotonicNanos() - start) / messages;
+    }
+    if (ssl) SSL_free(ssl);
+    close(fd);
+}
+
+bool TransportBenchmark::connectedPair(int& clientFd, int& serverFd) {
+    sockaddr_in address;
+    memset(&address, 0, sizeof(address));
+    address.sin_family = AF_INET;
+    address.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    socklen_t length = sizeof(address);
+
+    int listener = socket(AF_INET, SOCK_STREAM | SOCK_CLOEXEC, 0);
+    if (listener < 0 ||
+        bind(listener, reinterpret_cast<sockaddr*>(&address), sizeof(address)) != 0 ||
+        listen(listener, 1) != 0 ||
+        getsockname(listener, reinterpret_cast<sockaddr*>(&address), &length) != 0) {
+        perror("unable to listen on loopback");
+        if (listener >= 0) close(listener);
+        return false;
+    }
+    clientFd = socket(AF_INET, SOCK_STREAM | SOCK_CLOEXEC, 0);
+    if (clientFd < 0 || connect(clientFd, reinterpret_cast<sockaddr*>(&address), sizeof(address)) != 0) {
+        perror("unable to connect on loopback");
+        if (clientFd >= 0) close(clientFd);
+        close(listener);
+        return false;
+    }
+    serverFd = accept4(listener, NULL, NULL, SOCK_CLOEXEC);
+    close(listener);
+    if (serverFd < 0) {
+        perror("unable to accept on loopback");
+        close(clientFd);
+        return false;
+    }
+    // every message is a separate segment, as with a chatty client
+    int on = 1;
+    setsockopt(clientFd, IPPROTO_TCP, TCP_NODELAY, &on, sizeof(on));
+    setsockopt(serverFd, IPPROTO_TCP, TCP_NODELAY, &on, sizeof(on));
+    return true;
+}
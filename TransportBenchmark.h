@@ -0,0 +1,32 @@
+#ifndef TRANSPORTBENCHMARK_H
+#define TRANSPORTBENCHMARK_H
+
+#include <openssl/ossl_typ.h>
+
+#include <cstdint>
+
+// Times ping-pong round trips over a loopback TCP connection with the
+// server side driven by each of the worker's transports, so the cost one
+// transport adds per message shows against the others.  The client end
+// runs on its own thread with plain sockets or user-space TLS.
+class TransportBenchmark {
+public:
+    TransportBenchmark(SSL_CTX* serverCtx, unsigned int messages, unsigned int messageSize);
+    ~TransportBenchmark();
+
+    // prints one line per transport
+    void run();
+
+private:
+    // nanoseconds per round trip, 0 when the transport could not be used
+    template<class Transport> uint64_t measure(bool kernelTls);
+    static bool connectedPair(int& clientFd, int& serverFd);
+    void runClient(int fd, bool secure, uint64_t& nanos);
+
+    SSL_CTX* serverCtx;
+    SSL_CTX* clientCtx;
+    unsigned int messages;
+    unsigned int messageSize;
+};
+
+#endif
@@ -1,8 +1,13 @@
 #include "Worker.h"
+#include "Transport.h"
+#include "TransportBenchmark.h"
+#include "Logger.h"
 #include <iostream>
 #include <cstdio>
 #include <string>
 #include <time.h>
+#include <cstring>
+#include <cerrno>
 
 #include <boost/program_options.hpp>
 #include <boost/date_time.hpp>
@@ -17,27 +22,40 @@
 #include <linux/un.h>
 
 #include <sys/epoll.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <signal.h>
 
 #include <openssl/bio.h> // BIO objects for I/O
 #include <openssl/ssl.h> // SSL and SSL_CTX for SSL connections
 #include <openssl/err.h> // Error reporting
 
 
-Worker::Worker(int argc, char** argv) {
+Worker::Worker(int argc, char** argv) 
+    : multiConn(-1),
+      retiring(false),
+      handler(NULL),
+      flushReply(NULL)
+{
     parseOptions(argc, argv);
 
+    /* a peer that is gone must not kill the worker during SSL_shutdown */
+    signal(SIGPIPE, SIG_IGN);
+
     /* Initializing OpenSSL */
     SSL_library_init();
     SSL_load_error_strings();
     ERR_load_BIO_strings();
     OpenSSL_add_all_algorithms();
     
-    meth = SSLv3_method();
+    meth = TLS_server_method();
     ctx = SSL_CTX_new(meth);
     if (NULL == ctx) {
         std::cerr << "unable to create SSL ctx" << std::endl;
         abort();
     }
+    /* kernel TLS, tickets and SNI routing all need TLS 1.2 or later */
+    SSL_CTX_set_min_proto_version(ctx, TLS1_2_VERSION);
 
     /* Load the RSA CA certificate into the SSL_CTX structure */
     /* This will allow this client to verify the server's     */
@@ -57,6 +75,18 @@ Worker::Worker(int argc, char** argv) {
         abort();
     }
     
+#ifdef SSL_OP_ENABLE_KTLS
+    /* a sink can splice only what the kernel decrypts itself */
+    if (sink.enabled() || kernelTls) {
+        SSL_CTX_set_options(ctx, SSL_OP_ENABLE_KTLS);
+    }
+#else
+    if (kernelTls) {
+        std::cerr << "this OpenSSL has no kernel TLS support" << std::endl;
+        abort();
+    }
+#endif
+
     /* Check if the server certificate and private-key matches */
     if (!SSL_CTX_check_private_key(ctx)) {
         fprintf(stderr,"Private key does not match the certificate public key\n");
@@ -75,6 +105,28 @@ inline void addToEpoll(int newFd, int epollFd) {
     }
 }
 
+inline void modifyEpoll(int fd, int epollFd, bool wantWrite) {
+    epoll_event  event;
+    event.events = EPOLLIN|EPOLLPRI|EPOLLERR;
+    if (wantWrite) event.events |= EPOLLOUT;
+    event.data.fd = fd;
+    if (epoll_ctl(epollFd, EPOLL_CTL_MOD, fd, &event) != 0) {
+        perror("epoll_ctr modify fd failed.");
+        abort();
+    }
+}
+
+// only EPOLLERR and EPOLLHUP, which epoll always reports
+inline void watchErrors(int fd, int epollFd) {
+    epoll_event  event;
+    event.events = 0;
+    event.data.fd = fd;
+    if (epoll_ctl(epollFd, EPOLL_CTL_MOD, fd, &event) != 0) {
+        perror("epoll_ctr modify fd failed.");
+        abort();
+    }
+}
+
 inline void removeFromEpoll(int removedFd, int epollFd) {
     epoll_event  event;
     event.events = EPOLLIN|EPOLLPRI|EPOLLERR;
@@ -85,95 +137,625 @@ inline void removeFromEpoll(int removedFd, int epollFd) {
     }
 }
 
+inline void setNonBlocking(int fd) {
+    int flags = fcntl(fd, F_GETFL, 0);
+    if (flags < 0 || fcntl(fd, F_SETFL, flags | O_NONBLOCK) < 0) {
+        perror("unable to make socket non-blocking");
+        abort();
+    }
+}
+
 static const unsigned int CONTROLLEN = CMSG_LEN(sizeof(int ));
 
+inline uint64_t monotonicNanos() {
+    timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return uint64_t(now.tv_sec) * 1000000000ull + now.tv_nsec;
+}
+
 void Worker::run() {
 
-    int epollFd = epoll_create1(0);
-    epoll_event event;
+    // before the handshake threads start, they inherit the set
+    if (!cpus.empty() && !cpus.pin()) {
+        abort();
+    }
 
-    int multiConn = setupConnection();
-    addToEpoll(multiConn, epollFd);
-    std::stringstream registration;
-    registration << identifier << " " << secure;
-    send(multiConn, registration.str().c_str(), registration.str().size(), 0); 
+    if (benchmarkMessages > 0) {
+        TransportBenchmark benchmark(ctx, benchmarkMessages, benchmarkSize);
+        benchmark.run();
+        SSL_CTX_free(ctx);
+        return;
+    }
+
+    handler = createMessageHandler(handlerName, handlerArgument);
+    if (NULL == handler) {
+        std::cerr << "unable to create message handler " << handlerName << std::endl;
+        abort();
+    }
 
+    epollFd = epoll_create1(0);
+    multiConn = setupConnection();
+    addToEpoll(multiConn, epollFd);
+    if (load.create()) {
+        addToEpoll(load.eventFd(), epollFd);
+    } else {
+        LOG_WARN("running without shared load reporting");
+    }
+    if (secure && handshakeThreads > 0) {
+        if (!handshakes.start(handshakeThreads, handshakeTimeout)) {
+            std::cerr << "unable to start handshake threads" << std::endl;
+            abort();
+        }
+        addToEpoll(handshakes.eventFd(), epollFd);
+    }
+    sendRegistration();
+
+    if (!secure) {
+        eventLoop<PlainTransport>();
+    } else if (kernelTls) {
+        eventLoop<KernelTlsTransport>();
+    } else {
+        eventLoop<TlsTransport>();
+    }
+    LOG_INFO("worker retired");
+    handshakes.stop();
+    load.release();
+    SSL_CTX_free(ctx);
+}
 
-    while(1) {
-        int fds = epoll_wait(epollFd, &event, 1, -1);
+template<class Transport>
+void Worker::eventLoop() {
+    LOG_INFO("serving {} connections", Transport::name());
+    flushReply = &Worker::flushOutput<Transport>;
+    static const unsigned int maxEvents = 64;
+    epoll_event events[maxEvents];
+
+    // load is published every pass; the timeout keeps it fresh when idle
+    static const int loadIntervalMs = 100;
+    uint64_t busyNanos = 0;
+    uint64_t idleNanos = 0;
+    // sink throughput, reported once a second while data flows
+    static const uint64_t sinkReportNanos = 1000000000ull;
+    uint64_t sinkReportStart = monotonicNanos();
+    uint64_t sinkBusyNanos = 0;
+    uint64_t sinkReportBytes = 0;
+    // datagram flows have no close, silent ones are swept out
+    static const uint64_t flowSweepNanos = 1000000000ull;
+    uint64_t lastFlowSweep = monotonicNanos();
+
+    while(multiConn >= 0 || connections.size() > 0) {
+        uint64_t waitStart = monotonicNanos();
+        int fds = epoll_wait(epollFd, events, maxEvents, loadIntervalMs);
+        uint64_t passStart = monotonicNanos();
+        idleNanos += passStart - waitStart;
         if (fds < 0) {
+            if (errno == EINTR) continue;
             perror("epoll error");
             abort();
         }
-        if (fds == 0) continue;
 
         // run through connections looking for data to read
-        if (event.data.fd == multiConn) {
-            int newFd = getNewFileDescriptor(event.data.fd);
-            addToEpoll(newFd, epollFd);
-            if (secure) {
-                SSL* sslTemp = SSL_new(ctx);
-                if (NULL == sslTemp) {
-                    std::cerr << "unable to create new SSL connection" << std::endl;
-                    abort();
-                }
-                ssl[newFd] = sslTemp;
-                // flag it as server side
-                SSL_set_accept_state(sslTemp);
-
-                int err = SSL_set_fd(sslTemp, newFd);
-                if (err == 0) {
-                    std::cerr << "unable to set socket into ssl structure" << std::endl;
-                    abort();
-                }
-                err = SSL_accept(sslTemp);
-                while (err < 1 ) {
-                    err = SSL_accept(sslTemp);
+        for (int i = 0; i < fds; i++) {
+            epoll_event& event = events[i];
+            if (event.data.fd == multiConn) {
+                // each SOCK_SEQPACKET message is one complete hand-off, so
+                // every queued one can be taken without another epoll_wait
+                int flags = 0;
+                do {
+                    int newFd = getNewFileDescriptor(multiConn, flags);
+                    if (newFd < 0) break;
+                    acceptConnection<Transport>(newFd);
+                    flags = MSG_DONTWAIT;
+                } while (seqpacket);
+                continue;
+            }
+            if (load.valid() && event.data.fd == load.eventFd()) {
+                handleCommands();
+                continue;
+            }
+            if (handshakes.running() && event.data.fd == handshakes.eventFd()) {
+                finishHandshakes<Transport>();
+                continue;
+            }
+            int fd = event.data.fd;
+            Connection* conn = connections.find(fd);
+            if (conn == NULL) {
+                // closed earlier in this pass
+                continue;
+            }
+            if (conn->closing) {
+                closeConnection<Transport>(fd);
+                continue;
+            }
+            if (conn->handshake != Connection::Done) {
+                continueHandshake<Transport>(fd);
+                continue;
+            }
+            if ((event.events & EPOLLERR) && conn->output.zerocopyInFlight()) {
+                conn->output.reapCompletions(fd);
+            }
+            bool readable = (event.events & (EPOLLIN|EPOLLPRI|EPOLLHUP|EPOLLERR)) != 0;
+            if (event.events & EPOLLOUT) {
+                if (conn->readWantsWrite) {
+                    conn->readWantsWrite = false;
+                    readable = true;
                 }
-                if (err == 0) {
-                    std::cerr << "unable to negotiate ssl handshake" << std::endl;
-                    abort();
+                if (!flushOutput<Transport>(fd)) continue;
+            }
+            if (readable) {
+                readConnection<Transport>(fd);
+            }
+        }
+
+        if (!pending.empty()) {
+            // the batch data buffer is stable now, build the handler's view of it
+            batch.resize(pending.size());
+            for (size_t i = 0; i < pending.size(); i++) {
+                batch[i].fd = pending[i].fd;
+                batch[i].data = &batchData[pending[i].offset];
+                batch[i].length = pending[i].length;
+            }
+            handler->handle(&batch[0], batch.size(), *this);
+            pending.clear();
+            batchData.clear();
+        }
+
+        uint64_t passEnd = monotonicNanos();
+        if (!Transport::secure && flowIdle > 0 && passEnd - lastFlowSweep >= flowSweepNanos) {
+            expireFlows<Transport>(passEnd);
+            lastFlowSweep = passEnd;
+        }
+        busyNanos += passEnd - passStart;
+        if (sink.enabled()) {
+            sinkBusyNanos += passEnd - passStart;
+            if (passEnd - sinkReportStart >= sinkReportNanos) {
+                uint64_t bytes = sink.totalBytes() - sinkReportBytes;
+                if (bytes > 0) {
+                    double seconds = (passEnd - sinkReportStart) / 1e9;
+                    double busySeconds = sinkBusyNanos / 1e9;
+                    LOG_INFO("sink: {} GB/s, {} GB/s per busy core, {} bytes total",
+                             bytes / seconds / 1e9,
+                             busySeconds > 0 ? bytes / busySeconds / 1e9 : 0.0,
+                             sink.totalBytes());
                 }
+                sinkReportStart = passEnd;
+                sinkBusyNanos = 0;
+                sinkReportBytes = sink.totalBytes();
             }
-        } else {
-            // handle client data
-            static const unsigned int messageLength = 200; 
-            char message[messageLength];
-            int bytesRead=0;
-            if (secure) {
-                bytesRead = SSL_read(ssl[event.data.fd], &message, messageLength);
-            } else {
-                bytesRead = recv(event.data.fd, &message, messageLength-1, 0);
+        }
+        if (load.valid()) {
+            loadReport.activeConnections = connections.size();
+            loadReport.queueDepth = fds > 0 ? fds : 0;
+            // the connector prefers us for clients whose packets land here
+            int cpu = CpuSet::current();
+            if (cpu != loadReport.cpu) {
+                loadReport.cpu = cpu;
+                loadReport.node = CpuSet::nodeOf(cpu);
+            }
+            if (busyNanos + idleNanos >= loadIntervalMs * 1000000ull) {
+                loadReport.busyPermille = busyNanos * 1000 / (busyNanos + idleNanos);
+                busyNanos = 0;
+                idleNanos = 0;
             }
-            if (bytesRead > 0) {
-                message[bytesRead]='\0';
-                printf("%d:%s\n", bytesRead, message);
+            load.publish(loadReport);
+        }
+    }
+}
+
+void Worker::sendRegistration() {
+    std::stringstream registration;
+    registration << identifier << " " << secure;
+    std::string text = registration.str();
+
+    struct iovec iov[1];
+    iov[0].iov_base = &text[0];
+    iov[0].iov_len  = text.size();
+
+    struct msghdr msg;
+    memset(&msg, 0, sizeof(msg));
+    msg.msg_iov     = iov;
+    msg.msg_iovlen  = 1;
+
+    /* the load region and command eventfd travel with the registration */
+    static const unsigned int LOADCONTROLLEN = CMSG_SPACE(2 * sizeof(int));
+    char controlBuffer[LOADCONTROLLEN];
+    if (load.valid()) {
+        msg.msg_control    = controlBuffer;
+        msg.msg_controllen = LOADCONTROLLEN;
+        cmsghdr* cmptr = CMSG_FIRSTHDR(&msg);
+        cmptr->cmsg_level  = SOL_SOCKET;
+        cmptr->cmsg_type   = SCM_RIGHTS;
+        cmptr->cmsg_len    = CMSG_LEN(2 * sizeof(int));
+        int fds[2] = { load.memoryFd(), load.eventFd() };
+        memcpy(CMSG_DATA(cmptr), fds, sizeof(fds));
+    }
+    if (sendmsg(multiConn, &msg, 0) < 0) {
+        perror("unable to register with multiConnector .. terminating");
+        abort();
+    }
+}
+
+void Worker::handleCommands() {
+    load.clearWakeup();
+    uint32_t command;
+    while (load.takeCommand(command)) {
+        switch (command) {
+        case SharedLoad::Retire:
+            // stop taking work: the connector drops us when it sees the
+            // shutdown, hand-offs already queued are still served
+            if (!retiring) {
+                LOG_INFO("retiring, {} connections left", connections.size());
+                retiring = true;
+                shutdown(multiConn, SHUT_WR);
+            }
+            break;
+        default:
+            LOG_WARN("unknown command {} from connector", command);
+            break;
+        }
+    }
+}
+
+template<class Transport>
+void Worker::acceptConnection(int newFd) {
+    setNonBlocking(newFd);
+    loadReport.accepted++;
+    int type = SOCK_STREAM;
+    socklen_t typeLength = sizeof(type);
+    getsockopt(newFd, SOL_SOCKET, SO_TYPE, &type, &typeLength);
+    if (type == SOCK_DGRAM) {
+        if (Transport::secure || sink.enabled()) {
+            LOG_WARN("datagram flows need a plain worker without sink, closing socket {}", newFd);
+            close(newFd);
+            return;
+        }
+        Connection& flow = connections.insert(newFd);
+        flow.datagram = true;
+        flow.lastReceive = monotonicNanos();
+        flow.peerLength = sizeof(flow.peer);
+        if (getpeername(newFd, reinterpret_cast<sockaddr*>(&flow.peer), &flow.peerLength) != 0) {
+            LOG_WARN("datagram flow on socket {} is not connected, closing", newFd);
+            connections.erase(newFd);
+            close(newFd);
+            return;
+        }
+        addToEpoll(newFd, epollFd);
+        return;
+    }
+    Connection& conn = connections.insert(newFd);
+    if (Transport::secure) {
+        SSL* sslTemp = SSL_new(ctx);
+        if (NULL == sslTemp) {
+            std::cerr << "unable to create new SSL connection" << std::endl;
+            abort();
+        }
+        conn.ssl = sslTemp;
+        // flag it as server side
+        SSL_set_accept_state(sslTemp);
+
+        int err = SSL_set_fd(sslTemp, newFd);
+        if (err == 0) {
+            std::cerr << "unable to set socket into ssl structure" << std::endl;
+            abort();
+        }
+        if (handshakes.running()) {
+            conn.handshake = Connection::Offloaded;
+            handshakes.submit(newFd, sslTemp);
+            return;
+        }
+        conn.handshake = Connection::WantRead;
+        addToEpoll(newFd, epollFd);
+        continueHandshake<Transport>(newFd);
+        return;
+    }
+    addToEpoll(newFd, epollFd);
+    if (!connectionReady<Transport>(newFd)) return;
+    if (zerocopy) {
+        int on = 1;
+        if (setsockopt(newFd, SOL_SOCKET, SO_ZEROCOPY, &on, sizeof(on)) == 0) {
+            conn.output.enableZerocopy(zerocopyThreshold);
+        } else {
+            LOG_WARN("SO_ZEROCOPY not supported on socket {}: {}", newFd, strerror(errno));
+        }
+    }
+}
+
+template<class Transport>
+void Worker::continueHandshake(int fd) {
+    Connection& conn = *connections.find(fd);
+    int err = SSL_accept(conn.ssl);
+    if (err == 1) {
+        if (conn.handshake == Connection::WantWrite) modifyEpoll(fd, epollFd, false);
+        conn.handshake = Connection::Done;
+        if (!connectionReady<Transport>(fd)) return;
+        // the client may have sent data right behind its last handshake flight
+        readConnection<Transport>(fd);
+        return;
+    }
+    err = SSL_get_error(conn.ssl, err);
+    if (err == SSL_ERROR_WANT_READ || err == SSL_ERROR_WANT_WRITE) {
+        bool wantWrite = (err == SSL_ERROR_WANT_WRITE);
+        if (wantWrite != (conn.handshake == Connection::WantWrite)) {
+            modifyEpoll(fd, epollFd, wantWrite);
+        }
+        conn.handshake = wantWrite ? Connection::WantWrite : Connection::WantRead;
+        return;
+    }
+    LOG_INFO("unable to negotiate ssl handshake on socket {}", fd);
+    closeConnection<Transport>(fd);
+}
+
+template<class Transport>
+void Worker::finishHandshakes() {
+    std::vector<HandshakePool::Result> results;
+    handshakes.takeResults(results);
+    for (size_t i = 0; i < results.size(); i++) {
+        int fd = results[i].fd;
+        Connection& conn = *connections.find(fd);
+        if (!results[i].ok) {
+            SSL_free(conn.ssl);
+            connections.erase(fd);
+            close(fd);
+            continue;
+        }
+        conn.handshake = Connection::Done;
+        addToEpoll(fd, epollFd);
+        if (!connectionReady<Transport>(fd)) continue;
+        readConnection<Transport>(fd);
+    }
+}
+
+template<class Transport>
+bool Worker::connectionReady(int fd) {
+    Connection& conn = *connections.find(fd);
+    if (!Transport::usable(conn.ssl)) {
+        // the loop has no user-space record layer to fall back to
+        LOG_WARN("kernel TLS not engaged on socket {}, closing it", fd);
+        closeConnection<Transport>(fd);
+        return false;
+    }
+    if (!sink.enabled()) return true;
+    if (Transport::secure) {
+#ifndef OPENSSL_NO_KTLS
+        conn.kernelTls = BIO_get_ktls_recv(SSL_get_rbio(conn.ssl));
+#endif
+        if (!conn.kernelTls) {
+            LOG_INFO("no kernel TLS on socket {}, sink data is copied", fd);
+        }
+    }
+    if (!sink.open(conn.stream)) {
+        closeConnection<Transport>(fd);
+        return false;
+    }
+    return true;
+}
+
+template<class Transport>
+void Worker::readIntoSink(int fd) {
+    Connection& conn = *connections.find(fd);
+    uint64_t before = sink.totalBytes();
+    bool open = true;
+    if (Transport::secure) {
+        // records OpenSSL decrypted already; with kernel TLS only those
+        // read before the switch, without it every record.  Without read
+        // ahead OpenSSL takes one record per call and leaves the rest in
+        // the socket, so level triggered epoll brings us back for it.
+        static char buffer[65536];
+        size_t copied = 0;
+        while (open && (!conn.kernelTls || SSL_pending(conn.ssl) > 0) &&
+               (conn.kernelTls || copied < Sink::bytesPerPump)) {
+            int bytesRead = SSL_read(conn.ssl, buffer, sizeof(buffer));
+            if (bytesRead <= 0) {
+                int err = SSL_get_error(conn.ssl, bytesRead);
+                if (err == SSL_ERROR_WANT_READ || err == SSL_ERROR_WANT_WRITE) break;
+                open = false;
+            } else if (!sink.write(conn.stream, buffer, bytesRead)) {
+                open = false;
             } else {
-                if (bytesRead <= 0) {
-                    if (secure) {
-                        SSL_shutdown(ssl[event.data.fd]);
-                        SSL_free(ssl[event.data.fd]);
-                        ssl.erase(event.data.fd);
-                    }
-                    std::cout << "connection error or closed" << std::endl;
-                    removeFromEpoll(event.data.fd, epollFd);
-                    close(event.data.fd);
-                }                        
+                copied += bytesRead;
             }
         }
     }
-    close(multiConn);
-    SSL_CTX_free(ctx);
+    if (open && (!Transport::secure || conn.kernelTls)) {
+        Sink::Result result = sink.pump(conn.stream, fd);
+        open = (result == Sink::Drained || result == Sink::Busy);
+    }
+    conn.bytesIn += sink.totalBytes() - before;
+    if (!open) {
+        LOG_INFO("sink stream on socket {} closed after {} bytes", fd, conn.bytesIn);
+        closeConnection<Transport>(fd);
+    }
+}
+
+template<class Transport>
+void Worker::readConnection(int fd) {
+    if (sink.enabled()) {
+        readIntoSink<Transport>(fd);
+        return;
+    }
+    Connection& conn = *connections.find(fd);
+    if (!Transport::secure && conn.datagram) {
+        readDatagrams<Transport>(fd);
+        return;
+    }
+    // a full TLS record, so one read usually takes all OpenSSL decrypted
+    static const unsigned int readSize = 16384;
+    static char data[readSize];
+
+    bool retry = false;
+    int bytesRead = Transport::read(fd, conn.ssl, data, readSize, retry);
+    while (bytesRead > 0) {
+        conn.bytesIn += bytesRead;
+        // messages are lines; the tail of the read waits in partial for the rest
+        const char* start = data;
+        const char* end = data + bytesRead;
+        const char* newline;
+        while ((newline = static_cast<const char*>(memchr(start, '\n', end - start))) != NULL) {
+            size_t offset = batchData.size();
+            batchData.insert(batchData.end(), conn.partial.begin(), conn.partial.end());
+            batchData.insert(batchData.end(), start, newline + 1);
+            conn.partial.clear();
+            PendingMessage received = { fd, offset, batchData.size() - offset };
+            pending.push_back(received);
+            start = newline + 1;
+        }
+        conn.partial.insert(conn.partial.end(), start, end);
+        if (conn.partial.size() > maxMessage) {
+            LOG_WARN("message on socket {} exceeds {} bytes", fd, maxMessage);
+            closeConnection<Transport>(fd);
+            return;
+        }
+        // epoll does not know about data already in OpenSSL's buffer
+        if (!Transport::buffered(conn.ssl)) return;
+        bytesRead = Transport::read(fd, conn.ssl, data, readSize, retry);
+    }
+    if (retry) {
+        // e.g. a TLS 1.3 key update whose answer did not fit the socket
+        if (Transport::secure && SSL_want_write(conn.ssl)) {
+            conn.readWantsWrite = true;
+            watchWrites(fd, conn);
+        }
+        return;
+    }
+
+    LOG_INFO("connection error or closed on socket {}", fd);
+    closeConnection<Transport>(fd);
+}
+
+template<class Transport>
+void Worker::readDatagrams(int fd) {
+    Connection& conn = *connections.find(fd);
+    // a few per pass, so one busy flow does not hold up the others
+    static const unsigned int maxDatagrams = 16;
+    static char datagram[65536];
+    for (unsigned int i = 0; i < maxDatagrams; i++) {
+        sockaddr_storage source;
+        socklen_t sourceLength = sizeof(source);
+        ssize_t bytesRead = recvfrom(fd, datagram, sizeof(datagram), 0,
+                                     reinterpret_cast<sockaddr*>(&source), &sourceLength);
+        if (bytesRead < 0) {
+            if (errno == EAGAIN || errno == EWOULDBLOCK || errno == EINTR) return;
+            // e.g. ECONNREFUSED once the peer's port is gone
+            LOG_INFO("datagram flow on socket {} ended: {}", fd, strerror(errno));
+            closeConnection<Transport>(fd);
+            return;
+        }
+        if (sourceLength != conn.peerLength || memcmp(&source, &conn.peer, sourceLength) != 0) {
+            // queued before the connector connected the socket
+            LOG_DEBUG("datagram from another client dropped on flow socket {}", fd);
+            continue;
+        }
+        conn.lastReceive = monotonicNanos();
+        if (bytesRead == 0) {
+            // the client ends its flow with an empty datagram
+            LOG_INFO("datagram flow on socket {} closed by peer", fd);
+            closeConnection<Transport>(fd);
+            return;
+        }
+        conn.bytesIn += bytesRead;
+        size_t offset = batchData.size();
+        batchData.insert(batchData.end(), datagram, datagram + bytesRead);
+        PendingMessage received = { fd, offset, size_t(bytesRead) };
+        pending.push_back(received);
+    }
+}
+
+template<class Transport>
+void Worker::expireFlows(uint64_t now) {
+    uint64_t idleNanos = flowIdle * 1000000000ull;
+    for (size_t fd = 0; fd < connections.capacity(); fd++) {
+        Connection* conn = connections.find(fd);
+        if (conn == NULL || !conn->datagram || conn->closing) continue;
+        if (now - conn->lastReceive < idleNanos) continue;
+        LOG_INFO("datagram flow on socket {} idle for {} s, closing", fd, flowIdle);
+        closeConnection<Transport>(fd);
+    }
+}
+
+void Worker::reply(int fd, std::vector<char>& response) {
+    Connection* conn = connections.find(fd);
+    if (conn == NULL || conn->closing) {
+        LOG_WARN("reply to unknown socket {}", fd);
+        return;
+    }
+    // a blocked queue is flushed once the socket reports EPOLLOUT
+    bool idle = conn->output.empty();
+    conn->bytesOut += response.size();
+    conn->output.push(response);
+    if (idle) (this->*flushReply)(fd);
+}
+
+void Worker::reply(int fd, const char* data, size_t length) {
+    std::vector<char> response(data, data + length);
+    reply(fd, response);
+}
+
+template<class Transport>
+bool Worker::flushOutput(int fd) {
+    Connection& conn = *connections.find(fd);
+    OutputQueue& queue = conn.output;
+    OutputQueue::Result result = (!Transport::secure && conn.datagram)
+        ? queue.flushDatagrams(fd) : Transport::flush(queue, fd, conn.ssl);
+    if (result == OutputQueue::Failed) {
+        closeConnection<Transport>(fd);
+        return false;
+    }
+    watchWrites(fd, conn);
+    return true;
+}
+
+void Worker::watchWrites(int fd, Connection& conn) {
+    bool wanted = conn.output.blocked() || conn.readWantsWrite;
+    if (wanted != conn.pollingOut) {
+        modifyEpoll(fd, epollFd, wanted);
+        conn.pollingOut = wanted;
+    }
 }
 
-int Worker::getNewFileDescriptor(int socket) {
+template<class Transport>
+void Worker::closeConnection(int fd) {
+    Connection& conn = *connections.find(fd);
+    if (!conn.closing) {
+        LOG_DEBUG("socket {} closed after {} bytes in, {} bytes out", fd, conn.bytesIn, conn.bytesOut);
+        if (sink.enabled()) sink.close(conn.stream);
+        if (Transport::secure) {
+            if (conn.handshake == Connection::Done) Transport::shutdown(conn.ssl);
+            SSL_free(conn.ssl);
+            conn.ssl = NULL;
+        }
+        handler->closed(fd);
+        conn.output.discard();
+        conn.closing = true;
+        // a connection accepted later in this pass may get the same fd,
+        // what was read here must not reach the handler as its data
+        size_t kept = 0;
+        for (size_t i = 0; i < pending.size(); i++) {
+            if (pending[i].fd != fd) pending[kept++] = pending[i];
+        }
+        pending.resize(kept);
+    }
+    if (conn.output.zerocopyInFlight()) {
+        conn.output.reapCompletions(fd);
+    }
+    if (conn.output.zerocopyInFlight()) {
+        // the kernel still sends from those buffers, so they and the socket
+        // stay until it reports them done on the error queue
+        watchErrors(fd, epollFd);
+        return;
+    }
+    connections.erase(fd);
+    removeFromEpoll(fd, epollFd);
+    close(fd);
+}
+
+int Worker::getNewFileDescriptor(int socket, int flags) {
     static const unsigned int MAXLINE=200;
     char            buf[MAXLINE];
 
     /* size of control buffer to send/recv one file descriptor */
     static const unsigned int CONTROLLEN = CMSG_LEN(sizeof(int));
     char controlBuffer[CONTROLLEN];
-    static struct cmsghdr* cmptr  = reinterpret_cast<cmsghdr *>(&controlBuffer[0]);
+    struct cmsghdr* cmptr  = reinterpret_cast<cmsghdr *>(&controlBuffer[0]);
     
     struct iovec    iov[1];
     iov[0].iov_base = buf;
@@ -186,12 +768,43 @@ int Worker::getNewFileDescriptor(int socket) {
     msg.msg_namelen = 0;
     msg.msg_control    = cmptr;
     msg.msg_controllen = CONTROLLEN;
-    int bytesReceived = recvmsg(socket, &msg, 0);
+    int bytesReceived = recvmsg(socket, &msg, flags);
     if (bytesReceived < 0 ) {
-        printf("recvmsg error");
+        if (errno == EAGAIN || errno == EWOULDBLOCK) return -1;
+        LOG_ERROR("recvmsg error: {}", strerror(errno));
+        return -1;
     } else if (bytesReceived == 0) {
-        printf("connection closed by server");
-        exit(0);
+        if (!retiring) {
+            LOG_INFO("connection closed by server");
+            exit(0);
+        }
+        removeFromEpoll(multiConn, epollFd);
+        close(multiConn);
+        multiConn = -1;
+        return -1;
+    }
+
+    /* a zero status is only good with the descriptor attached */
+    bool hasFd = msg.msg_controllen >= CONTROLLEN &&
+                 cmptr->cmsg_level == SOL_SOCKET &&
+                 cmptr->cmsg_type == SCM_RIGHTS &&
+                 cmptr->cmsg_len == CONTROLLEN;
+
+    if (seqpacket) {
+        /* the whole message is the status byte, no scanning needed */
+        if (bytesReceived != 1 || (msg.msg_flags & (MSG_TRUNC|MSG_CTRUNC))) {
+            LOG_WARN("message format error");
+            return -1;
+        }
+        int status = buf[0] & 0xFF;
+        if (status != 0) return -status;
+        if (!hasFd) {
+            LOG_WARN("hand-off without a descriptor");
+            return -1;
+        }
+        int newfd = *(int *)CMSG_DATA(cmptr);
+        LOG_INFO("acepted new file descriptor {}", newfd);
+        return newfd;
     }
     /*
      * See if this is the final data with null & status.  Null
@@ -203,10 +816,12 @@ int Worker::getNewFileDescriptor(int socket) {
     for (ptr = buf; ptr < &buf[bytesReceived]; ) {
         if (*ptr++ == 0) {
             if (ptr != &buf[bytesReceived-1])
-            printf("message format error");
+            LOG_WARN("message format error");
             int status = *ptr & 0xFF;  /* prevent sign extension */
-            if (status == 0) {
+            if (status == 0 && hasFd) {
                 newfd = *(int *)CMSG_DATA(cmptr);
+            } else if (status == 0) {
+                LOG_WARN("hand-off without a descriptor");
             } else {
                 newfd = -status;
             }
@@ -214,7 +829,7 @@ int Worker::getNewFileDescriptor(int socket) {
         }
     }
 
-    std::cout << "acepted new file descriptor " << newfd << std::endl; 
+    LOG_INFO("acepted new file descriptor {}", newfd);
     return newfd;
 }
 
@@ -224,7 +839,7 @@ int Worker::setupConnection() {
     multiConnAddr.sun_family = AF_UNIX;
     strcpy(multiConnAddr.sun_path, domainPath.c_str());
     
-    int multiConn = socket(PF_UNIX, SOCK_STREAM, 0);
+    int multiConn = socket(PF_UNIX, seqpacket ? SOCK_SEQPACKET : SOCK_STREAM, 0);
     if (multiConn < 0) {
         perror("Unable to connect to multiConnector .. terminating");
         abort();
@@ -245,7 +860,24 @@ void Worker::parseOptions(int argc, char** argv) {
         
     domainPath = "/tmp/shared.fd";
     secure = false;
+    kernelTls = false;
+    zerocopy = false;
+    seqpacket = false;
+    zerocopyThreshold = 16384;
+    handshakeThreads = 0;
+    handshakeTimeout = 10000;
+    benchmarkMessages = 0;
+    benchmarkSize = 64;
+    maxMessage = 65536;
+    flowIdle = 60;
+    handlerName = "print";
     identifier = 123456;
+    std::string logLevel = "info";
+    std::string cpuList;
+    std::string sinkPath;
+    std::string sinkSync = "close";
+    uint64_t sinkRotateBytes = 0;
+    uint64_t sinkSyncBytes = 64 << 20;
    try {
         boost::program_options::options_description desc("Options");
         desc.add_options()
@@ -253,6 +885,24 @@ void Worker::parseOptions(int argc, char** argv) {
         ("identifier,id", boost::program_options::value<unsigned int>(&identifier), "identifier used for communications")
         ("domainPath,d", boost::program_options::value<std::string>(&domainPath), "file to be used as name for domain socket")
         ("secure,s", boost::program_options::bool_switch(&secure), "use ssl for communications")
+        ("ktls", boost::program_options::bool_switch(&kernelTls), "with --secure, leave the TLS record layer to the kernel and close connections it cannot take")
+        ("seqpacket", boost::program_options::bool_switch(&seqpacket), "use SOCK_SEQPACKET for the connector domain socket")
+        ("zerocopy", boost::program_options::bool_switch(&zerocopy), "send large plain text responses with MSG_ZEROCOPY")
+        ("zerocopyThreshold", boost::program_options::value<unsigned int>(&zerocopyThreshold), "smallest response in bytes sent with MSG_ZEROCOPY")
+        ("cpus", boost::program_options::value<std::string>(&cpuList), "pin the worker's threads to these cpus, e.g. 0-3,8")
+        ("handshakeThreads", boost::program_options::value<unsigned int>(&handshakeThreads), "threads running TLS handshakes, 0 runs them on the event loop")
+        ("handshakeTimeout", boost::program_options::value<unsigned int>(&handshakeTimeout), "ms a pooled TLS handshake may take")
+        ("sink", boost::program_options::value<std::string>(&sinkPath), "splice client streams into a file per connection in this directory, or into this file or FIFO (a stalled FIFO reader stalls the worker)")
+        ("sinkRotateBytes", boost::program_options::value<uint64_t>(&sinkRotateBytes), "start a new sink file after this many bytes, 0 never")
+        ("sinkSync", boost::program_options::value<std::string>(&sinkSync), "fdatasync sink files: none, close (and rotate) or periodic")
+        ("sinkSyncBytes", boost::program_options::value<uint64_t>(&sinkSyncBytes), "bytes between fdatasync calls with --sinkSync periodic")
+        ("maxMessage", boost::program_options::value<unsigned int>(&maxMessage), "longest message line in bytes before the connection is closed")
+        ("flowIdle", boost::program_options::value<unsigned int>(&flowIdle), "seconds without a datagram before a UDP flow is closed, 0 never")
+        ("handler", boost::program_options::value<std::string>(&handlerName), "message handler: print, echo or path of a shared object")
+        ("handlerArg", boost::program_options::value<std::string>(&handlerArgument), "argument passed to the message handler")
+        ("benchmark", boost::program_options::value<unsigned int>(&benchmarkMessages), "time this many round trips over each transport on loopback and exit")
+        ("benchmarkSize", boost::program_options::value<unsigned int>(&benchmarkSize), "message size in bytes for --benchmark")
+        ("logLevel", boost::program_options::value<std::string>(&logLevel), "debug, info, warn or error")
         ;
         try {
             store(parse_command_line(argc, argv, desc), options_map);
@@ -272,6 +922,35 @@ void Worker::parseOptions(int argc, char** argv) {
         throw;
     }    
 
+   Logger::Level level;
+   if (!Logger::parseLevel(logLevel, level)) {
+       std::cout << "unknown log level " << logLevel << std::endl;
+       exit(4);
+   }
+   Logger::instance().setLevel(level);
+   Sink::SyncPolicy syncPolicy;
+   if (!Sink::parseSyncPolicy(sinkSync, syncPolicy)) {
+       std::cout << "unknown sink sync policy " << sinkSync << std::endl;
+       exit(4);
+   }
+   if (!sinkPath.empty() && !sink.configure(sinkPath, identifier, sinkRotateBytes, syncPolicy, sinkSyncBytes)) {
+       exit(4);
+   }
+   if (!cpuList.empty() && !cpus.parse(cpuList)) {
+       std::cout << "unusable cpu list " << cpuList << std::endl;
+       exit(4);
+   }
+
+   if (kernelTls && !secure) {
+       std::cout << "--ktls needs --secure" << std::endl;
+       exit(4);
+   }
+   if (benchmarkSize == 0) {
+       std::cout << "--benchmarkSize must be positive" << std::endl;
+       exit(4);
+   }
+   if (benchmarkMessages > 0) return;
+
    if (secure) {
        std::cout << "Will serve only secure connections" << std::endl;
    } else {
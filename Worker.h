@@ -4,32 +4,123 @@
 #include <openssl/ossl_typ.h>
 #include <openssl/ssl.h>
 
+#include "OutputQueue.h"
+#include "MessageHandler.h"
+#include "SharedLoad.h"
+#include "FdTable.h"
+#include "HandshakePool.h"
+#include "CpuSet.h"
+#include "Sink.h"
+
 #include <boost/program_options.hpp>
 #include <string>
-#include <map>
+#include <vector>
+#include <sys/socket.h>
 
-class Worker {
+class Worker : public Responder {
 public:
     Worker(int argc, char** argv);
     void run();
 
+    // queue data for a client connection; takes the contents of response
+    virtual void reply(int fd, std::vector<char>& response);
+    virtual void reply(int fd, const char* data, size_t length);
+
 private:
     // methods
     void parseOptions(int argc, char** argv);
     int setupConnection();
-    int getNewFileDescriptor(int socket);
+    int getNewFileDescriptor(int socket, int flags);
+    void sendRegistration();
+    void handleCommands();
+
+    // one instantiation per transport, picked by run()
+    template<class Transport> void eventLoop();
+    template<class Transport> void acceptConnection(int newFd);
+    template<class Transport> void continueHandshake(int fd);
+    template<class Transport> void finishHandshakes();
+    template<class Transport> bool connectionReady(int fd);
+    template<class Transport> void readConnection(int fd);
+    template<class Transport> void readIntoSink(int fd);
+    template<class Transport> void readDatagrams(int fd);
+    template<class Transport> void expireFlows(uint64_t now);
+    template<class Transport> void closeConnection(int fd);
+    template<class Transport> bool flushOutput(int fd);
+    struct Connection;
+    void watchWrites(int fd, Connection& conn);
 
 private:    
     // variables
     unsigned int identifier;
     std::string domainPath;
     bool secure;
+    bool kernelTls;
+    bool seqpacket;
+    bool zerocopy;
+    unsigned int zerocopyThreshold;
+    CpuSet cpus;
+    unsigned int handshakeThreads;
+    unsigned int handshakeTimeout;
+    HandshakePool handshakes;
+    int epollFd;
+    int multiConn;
+    bool retiring;
+    SharedLoad load;
+    SharedLoad::Snapshot loadReport;
+    std::string handlerName;
+    std::string handlerArgument;
+    MessageHandler* handler;
+    unsigned int maxMessage;
+    unsigned int flowIdle;      // s a datagram flow may stay silent, 0 for ever
+    // flushOutput of the running transport, for reply()
+    bool (Worker::*flushReply)(int fd);
+    // --benchmark: round trips per transport instead of serving
+    unsigned int benchmarkMessages;
+    unsigned int benchmarkSize;
+    // --sink: streams go to files or a pipe instead of the handler
+    Sink sink;
+
+    // messages read during the current pass of the event loop
+    std::vector<char> batchData;
+    struct PendingMessage {
+        int fd;
+        size_t offset;
+        size_t length;
+    };
+    std::vector<PendingMessage> pending;
+    std::vector<Message> batch;
 
     // Parsed argument values
     boost::program_options::variables_map options_map;
 
+    // per client connection state, indexed by fd
+    struct Connection {
+        Connection()
+            : ssl(NULL), handshake(Done), kernelTls(false), datagram(false),
+              readWantsWrite(false), pollingOut(false), closing(false), bytesIn(0), bytesOut(0),
+              lastReceive(0), peerLength(0) {}
+        SSL* ssl;
+        // WantRead/WantWrite: handshake driven by the event loop,
+        // Offloaded: owned by the handshake pool and not in epollFd
+        enum { Done, WantRead, WantWrite, Offloaded } handshake;
+        bool kernelTls;         // the kernel decrypts what we read
+        bool datagram;          // connected UDP flow, one message per datagram
+        bool readWantsWrite;    // SSL_read has to write before it can go on
+        bool pollingOut;        // EPOLLOUT is armed
+        bool closing;           // closed, waiting for MSG_ZEROCOPY completions
+        Sink::Stream stream;
+        std::vector<char> partial;      // start of a message not complete yet
+        OutputQueue output;
+        uint64_t bytesIn;
+        uint64_t bytesOut;
+        // datagram flows: when the last datagram came, and from whom they may
+        uint64_t lastReceive;
+        sockaddr_storage peer;
+        socklen_t peerLength;
+    };
+    FdTable<Connection> connections;
+
     SSL_CTX         *ctx;
-    std::map<int, SSL*> ssl;
     const SSL_METHOD      *meth;
     //X509            *server_cert;
     //EVP_PKEY        *pkey;